@@ -0,0 +1,363 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "async_sql.h"
+#include "../metrics/trace.h"
+
+async_sql::async_sql()
+{
+    m_epollfd = -1;
+    m_wakeup_fd = -1;
+    m_close_log = 0;
+}
+
+async_sql::~async_sql()
+{
+    //与sql_batch一样，退出前把排队和正在执行的任务写完，回调照常执行(写库失败的用户从缓存撤销)
+    drain(DRAIN_TIMEOUT_MS);
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        for (int j = 0; j < STMT_NUM; ++j)
+            if (m_conns[i].stmts[j])
+                mysql_stmt_close(m_conns[i].stmts[j]);
+        mysql_close(m_conns[i].mysql);
+    }
+    if (m_wakeup_fd >= 0)
+        close(m_wakeup_fd);
+}
+
+#ifdef MYSQL_WAIT_READ
+
+bool async_sql::init(string url, string User, string PassWord, string DBName, int Port,
+                     int conn_num, int close_log)
+{
+    m_close_log = close_log;
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeup_fd < 0)
+        return false;
+    set_index(m_wakeup_fd, WAKEUP_INDEX);
+
+    for (int i = 0; i < conn_num; ++i)
+    {
+        sql_conn conn;
+        memset(&conn, 0, sizeof(conn));
+        conn.mysql = mysql_init(NULL);
+        if (conn.mysql == NULL)
+            return false;
+        //开启非阻塞模式后，启动阶段仍可使用普通的阻塞接口建立连接和准备语句
+        mysql_options(conn.mysql, MYSQL_OPT_NONBLOCK, 0);
+        if (mysql_real_connect(conn.mysql, url.c_str(), User.c_str(), PassWord.c_str(),
+                               DBName.c_str(), Port, NULL, 0) == NULL)
+        {
+            LOG_ERROR("async MySQL connect error:%s", mysql_error(conn.mysql));
+            mysql_close(conn.mysql);
+            return false;
+        }
+        for (int j = 0; j < STMT_NUM; ++j)
+        {
+            conn.stmts[j] = mysql_stmt_init(conn.mysql);
+            if (conn.stmts[j] && mysql_stmt_prepare(conn.stmts[j], stmt_sql[j], strlen(stmt_sql[j])))
+            {
+                LOG_ERROR("async prepare \"%s\" error:%s", stmt_sql[j], mysql_stmt_error(conn.stmts[j]));
+                mysql_stmt_close(conn.stmts[j]);
+                conn.stmts[j] = NULL;
+            }
+        }
+        conn.fd = mysql_get_socket(conn.mysql);
+        conn.in_epoll = false;
+        conn.status = 0;
+        conn.job = NULL;
+        m_conns.push_back(conn);
+        set_index(conn.fd, m_conns.size() - 1);
+    }
+    return !m_conns.empty();
+}
+
+#else
+
+//客户端库不支持非阻塞API
+bool async_sql::init(string url, string User, string PassWord, string DBName, int Port,
+                     int conn_num, int close_log)
+{
+    m_close_log = close_log;
+    LOG_WARN("%s", "MySQL client library has no non-blocking API, async sql disabled");
+    return false;
+}
+
+#endif
+
+void async_sql::attach(int epollfd)
+{
+    m_epollfd = epollfd;
+    epoll_event event;
+    event.data.fd = m_wakeup_fd;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakeup_fd, &event);
+}
+
+void async_sql::set_index(int fd, int index)
+{
+    if (fd < 0)
+        return;
+    if (fd >= (int)m_fd_index.size())
+        m_fd_index.resize(fd + 1, NO_INDEX);
+    m_fd_index[fd] = index;
+}
+
+bool async_sql::exec(int stmt_id, const char **params, int n, sql_cb cb, void *arg)
+{
+    if (m_conns.empty() || n > MAX_PARAMS || stmt_id < 0 || stmt_id >= STMT_NUM)
+        return false;
+
+    //参数在任务中保留一份拷贝，查询完成前绑定的缓冲区必须一直有效
+    sql_job *job = new sql_job;
+    job->stmt_id = stmt_id;
+    job->param_num = n;
+    job->cb = cb;
+    job->arg = arg;
+    for (int i = 0; i < n; ++i)
+        job->params[i] = params[i];
+
+    m_lock.lock();
+    m_pending.push_back(job);
+    m_lock.unlock();
+
+    //唤醒主线程派发任务
+    uint64_t one = 1;
+    ssize_t ret = write(m_wakeup_fd, &one, sizeof(one));
+    (void)ret;
+    return true;
+}
+
+void async_sql::handle_event(int fd, unsigned int events)
+{
+    int index = m_fd_index[fd];
+    if (WAKEUP_INDEX == index)
+    {
+        uint64_t count;
+        ssize_t ret = read(m_wakeup_fd, &count, sizeof(count));
+        (void)ret;
+        dispatch();
+        return;
+    }
+
+#ifdef MYSQL_WAIT_READ
+    sql_conn &conn = m_conns[index];
+    if (conn.job == NULL)
+        return;
+
+    int ready = 0;
+    if (events & EPOLLIN)
+        ready |= MYSQL_WAIT_READ;
+    if (events & EPOLLOUT)
+        ready |= MYSQL_WAIT_WRITE;
+    if (events & EPOLLPRI)
+        ready |= MYSQL_WAIT_EXCEPT;
+    if (events & (EPOLLERR | EPOLLHUP))
+        ready |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE;
+
+    resume(conn, ready);
+
+    //连接空出来了，继续处理排队的任务
+    if (conn.job == NULL)
+        dispatch();
+#endif
+}
+
+//连接上的等待条件已满足，继续执行语句
+void async_sql::resume(sql_conn &conn, int ready)
+{
+#ifdef MYSQL_WAIT_READ
+    int ret = 0;
+    int status = mysql_stmt_execute_cont(&ret, conn.stmts[conn.job->stmt_id], ready);
+    if (status)
+        wait_io(conn, status);
+    else
+        finish(conn, ret);
+#endif
+}
+
+//析构时调用，此时主线程的事件循环已退出：直接poll各连接推进剩余任务，
+//超过timeout_ms仍未完成的任务以失败回调，保证每个任务的回调都恰好执行一次
+void async_sql::drain(int timeout_ms)
+{
+    long long deadline = trace::now_us() + timeout_ms * 1000LL;
+    dispatch();
+#ifdef MYSQL_WAIT_READ
+    while (trace::now_us() < deadline)
+    {
+        vector<pollfd> fds;
+        vector<size_t> index;
+        for (size_t i = 0; i < m_conns.size(); ++i)
+        {
+            if (NULL == m_conns[i].job)
+                continue;
+            pollfd p;
+            p.fd = m_conns[i].fd;
+            p.events = 0;
+            p.revents = 0;
+            if (m_conns[i].status & (MYSQL_WAIT_READ | MYSQL_WAIT_TIMEOUT))
+                p.events |= POLLIN;
+            if (m_conns[i].status & MYSQL_WAIT_WRITE)
+                p.events |= POLLOUT;
+            if (m_conns[i].status & MYSQL_WAIT_EXCEPT)
+                p.events |= POLLPRI;
+            fds.push_back(p);
+            index.push_back(i);
+        }
+        if (fds.empty())
+            break;
+
+        int left_ms = (int)((deadline - trace::now_us()) / 1000) + 1;
+        if (poll(&fds[0], fds.size(), left_ms) < 0 && errno != EINTR)
+            break;
+        for (size_t k = 0; k < fds.size(); ++k)
+        {
+            if (0 == fds[k].revents)
+                continue;
+            int ready = 0;
+            if (fds[k].revents & POLLIN)
+                ready |= MYSQL_WAIT_READ;
+            if (fds[k].revents & POLLOUT)
+                ready |= MYSQL_WAIT_WRITE;
+            if (fds[k].revents & POLLPRI)
+                ready |= MYSQL_WAIT_EXCEPT;
+            if (fds[k].revents & (POLLERR | POLLHUP))
+                ready |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE;
+            resume(m_conns[index[k]], ready);
+        }
+        dispatch();
+    }
+#endif
+
+    int failed = 0;
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        sql_job *job = m_conns[i].job;
+        if (job)
+        {
+            m_conns[i].job = NULL;
+            job->cb(job->arg, -1);
+            delete job;
+            ++failed;
+        }
+    }
+    m_lock.lock();
+    list<sql_job *> pending;
+    pending.swap(m_pending);
+    m_lock.unlock();
+    for (list<sql_job *>::iterator it = pending.begin(); it != pending.end(); ++it)
+    {
+        (*it)->cb((*it)->arg, -1);
+        delete *it;
+        ++failed;
+    }
+    if (failed)
+        LOG_ERROR("async sql: %d jobs not finished before exit", failed);
+}
+
+//把等待中的任务分给空闲连接
+void async_sql::dispatch()
+{
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        //任务可能在start中就同步完成，此时连接仍空闲，继续取下一个
+        while (NULL == m_conns[i].job)
+        {
+            m_lock.lock();
+            if (m_pending.empty())
+            {
+                m_lock.unlock();
+                return;
+            }
+            sql_job *job = m_pending.front();
+            m_pending.pop_front();
+            m_lock.unlock();
+
+            start(m_conns[i], job);
+        }
+    }
+}
+
+void async_sql::start(sql_conn &conn, sql_job *job)
+{
+    conn.job = job;
+    MYSQL_STMT *stmt = conn.stmts[job->stmt_id];
+    if (stmt == NULL)
+    {
+        finish(conn, -1);
+        return;
+    }
+
+    memset(job->bind, 0, sizeof(job->bind));
+    for (int i = 0; i < job->param_num; ++i)
+    {
+        job->length[i] = job->params[i].size();
+        job->bind[i].buffer_type = MYSQL_TYPE_STRING;
+        job->bind[i].buffer = (void *)job->params[i].c_str();
+        job->bind[i].buffer_length = job->length[i];
+        job->bind[i].length = &job->length[i];
+    }
+    if (mysql_stmt_bind_param(stmt, job->bind))
+    {
+        finish(conn, -1);
+        return;
+    }
+
+#ifdef MYSQL_WAIT_READ
+    int ret = 0;
+    int status = mysql_stmt_execute_start(&ret, stmt);
+    if (status)
+        wait_io(conn, status);
+    else
+        finish(conn, ret);
+#endif
+}
+
+//按库返回的等待状态注册读写事件，EPOLLONESHOT保证每次只回调一次
+void async_sql::wait_io(sql_conn &conn, int status)
+{
+#ifdef MYSQL_WAIT_READ
+    conn.status = status;
+    epoll_event event;
+    event.data.fd = conn.fd;
+    event.events = EPOLLONESHOT;
+    if (status & (MYSQL_WAIT_READ | MYSQL_WAIT_TIMEOUT))
+        event.events |= EPOLLIN;
+    if (status & MYSQL_WAIT_WRITE)
+        event.events |= EPOLLOUT;
+    if (status & MYSQL_WAIT_EXCEPT)
+        event.events |= EPOLLPRI;
+
+    if (conn.in_epoll)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_MOD, conn.fd, &event);
+    }
+    else
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, conn.fd, &event);
+        conn.in_epoll = true;
+    }
+#endif
+}
+
+void async_sql::finish(sql_conn &conn, int ret)
+{
+    sql_job *job = conn.job;
+    int result = 0;
+    if (ret)
+    {
+        MYSQL_STMT *stmt = conn.stmts[job->stmt_id];
+        result = stmt ? mysql_stmt_errno(stmt) : -1;
+        if (0 == result)
+            result = -1;
+        LOG_ERROR("async execute \"%s\" error:%d", stmt_sql[job->stmt_id], result);
+    }
+    conn.job = NULL;
+
+    job->cb(job->arg, result);
+    delete job;
+}
@@ -0,0 +1,94 @@
+#ifndef ASYNC_SQL_H
+#define ASYNC_SQL_H
+
+#include <list>
+#include <vector>
+#include <string>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+#include "../log/log.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+//查询完成回调，result为0表示成功，否则为错误码；在主线程(事件循环)中调用
+typedef void (*sql_cb)(void *arg, int result);
+
+/*************************************************************
+*基于MariaDB非阻塞API(mysql_stmt_execute_start/_cont)的异步数据库客户端
+*几条连接的socket直接注册到主线程的epoll中，工作线程只负责投递任务，
+*查询期间不占用任何线程，完成后在主线程中回调
+*非MariaDB客户端库不提供该API，此时init返回false，调用方走同步路径
+**************************************************************/
+class async_sql
+{
+public:
+    async_sql();
+    ~async_sql();
+
+    //建立conn_num条非阻塞连接并准备预处理语句
+    bool init(string url, string User, string PassWord, string DBName, int Port,
+              int conn_num, int close_log);
+    //将唤醒用的eventfd注册到主线程的epoll
+    void attach(int epollfd);
+
+    //任意线程调用：以绑定参数方式执行预处理语句，完成后回调cb(arg, result)
+    bool exec(int stmt_id, const char **params, int n, sql_cb cb, void *arg);
+
+    //fd是否属于本客户端(eventfd或数据库连接)
+    bool owns(int fd) const
+    {
+        return fd >= 0 && fd < (int)m_fd_index.size() && m_fd_index[fd] != NO_INDEX;
+    }
+    //主线程调用：处理owns()为真的fd上的事件
+    void handle_event(int fd, unsigned int events);
+
+private:
+    enum
+    {
+        MAX_PARAMS = 4,
+        NO_INDEX = -2,     //fd不属于本客户端
+        WAKEUP_INDEX = -1, //唤醒用的eventfd
+        DRAIN_TIMEOUT_MS = 5000 //析构时等待剩余任务完成的最长时间
+    };
+
+    struct sql_job
+    {
+        int stmt_id;
+        int param_num;
+        string params[MAX_PARAMS];
+        unsigned long length[MAX_PARAMS];
+        MYSQL_BIND bind[MAX_PARAMS];
+        sql_cb cb;
+        void *arg;
+    };
+
+    struct sql_conn
+    {
+        MYSQL *mysql;
+        MYSQL_STMT *stmts[STMT_NUM];
+        int fd;
+        bool in_epoll;
+        int status;   //库返回的等待状态，drain中据此poll
+        sql_job *job; //正在执行的任务
+    };
+
+    void dispatch();
+    void start(sql_conn &conn, sql_job *job);
+    void resume(sql_conn &conn, int ready);
+    void wait_io(sql_conn &conn, int status);
+    void finish(sql_conn &conn, int ret);
+    void drain(int timeout_ms);
+    void set_index(int fd, int index);
+
+    vector<sql_conn> m_conns;
+    vector<int> m_fd_index; //fd -> m_conns下标，仅主线程访问
+    int m_epollfd;
+    int m_wakeup_fd;
+
+    locker m_lock;            //保护m_pending
+    list<sql_job *> m_pending; //等待空闲连接的任务
+    int m_close_log;
+};
+
+#endif
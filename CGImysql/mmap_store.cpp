@@ -0,0 +1,237 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmap_store.h"
+
+static const char STORE_MAGIC[8] = {'U', 'S', 'R', 'S', 'T', 'O', 'R', '1'};
+//新文件的初始大小和初始槽数
+static const uint64_t INIT_FILE_SIZE = 1 << 20;
+static const uint64_t INIT_SLOTS = 1024;
+
+mmap_store::mmap_store()
+{
+    m_fd = -1;
+    m_base = NULL;
+    m_size = 0;
+    m_close_log = 0;
+}
+
+mmap_store::~mmap_store()
+{
+    if (m_base)
+    {
+        msync(m_base, m_size, MS_SYNC);
+        munmap(m_base, m_size);
+    }
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+bool mmap_store::init(const char *path, int close_log)
+{
+    m_close_log = close_log;
+    m_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd < 0)
+    {
+        LOG_ERROR("open user store %s error:%d", path, errno);
+        return false;
+    }
+
+    struct stat st;
+    fstat(m_fd, &st);
+    bool fresh = 0 == st.st_size;
+    if (fresh)
+    {
+        if (ftruncate(m_fd, INIT_FILE_SIZE) < 0)
+            return false;
+        m_size = INIT_FILE_SIZE;
+    }
+    else if ((uint64_t)st.st_size < sizeof(file_header))
+    {
+        LOG_ERROR("user store %s is truncated", path);
+        return false;
+    }
+    else
+        m_size = st.st_size;
+
+    m_base = (char *)mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (MAP_FAILED == m_base)
+    {
+        m_base = NULL;
+        LOG_ERROR("mmap user store %s error:%d", path, errno);
+        return false;
+    }
+
+    file_header *hdr = header();
+    if (fresh)
+    {
+        //新扩大的文件内容全为0，空槽不需要额外初始化
+        memcpy(hdr->magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        hdr->used = (sizeof(file_header) + 7) & ~7ULL;
+        hdr->count = 0;
+        hdr->slot_num = INIT_SLOTS;
+        hdr->slot_off = alloc(INIT_SLOTS * sizeof(slot));
+    }
+    else if (memcmp(hdr->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || hdr->used > m_size ||
+             hdr->slot_off + hdr->slot_num * sizeof(slot) > hdr->used)
+    {
+        LOG_ERROR("user store %s has bad format", path);
+        return false;
+    }
+    LOG_INFO("user store %s opened, %llu users", path, (unsigned long long)hdr->count);
+    return 0 != hdr->slot_off;
+}
+
+//FNV-1a
+uint64_t mmap_store::hash_name(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+mmap_store::slot *mmap_store::probe(uint64_t h, const char *name, size_t len) const
+{
+    slot *s = slots();
+    uint64_t mask = header()->slot_num - 1;
+    for (uint64_t i = h & mask;; i = (i + 1) & mask)
+    {
+        if (0 == s[i].off)
+            return &s[i];
+        if (s[i].hash == h)
+        {
+            record *r = record_at(s[i].off);
+            if (r->name_len == len && memcmp(r->data, name, len) == 0)
+                return &s[i];
+        }
+    }
+}
+
+bool mmap_store::grow_file(uint64_t need)
+{
+    uint64_t new_size = m_size;
+    while (new_size < need)
+        new_size *= 2;
+    if (ftruncate(m_fd, new_size) < 0)
+    {
+        LOG_ERROR("grow user store error:%d", errno);
+        return false;
+    }
+    void *base = mremap(m_base, m_size, new_size, MREMAP_MAYMOVE);
+    if (MAP_FAILED == base)
+    {
+        LOG_ERROR("mremap user store error:%d", errno);
+        return false;
+    }
+    m_base = (char *)base;
+    m_size = new_size;
+    return true;
+}
+
+uint64_t mmap_store::alloc(size_t n)
+{
+    uint64_t off = header()->used;
+    uint64_t end = off + ((n + 7) & ~(size_t)7);
+    if (end > m_size && !grow_file(end))
+        return 0;
+    header()->used = end;
+    return off;
+}
+
+//槽数翻倍，调用时持有写锁
+bool mmap_store::rehash()
+{
+    uint64_t old_num = header()->slot_num;
+    uint64_t new_off = alloc(old_num * 2 * sizeof(slot));
+    if (0 == new_off)
+        return false;
+
+    //alloc可能移动了映射，之后再取指针
+    slot *old_slots = slots();
+    slot *new_slots = (slot *)(m_base + new_off);
+    uint64_t mask = old_num * 2 - 1;
+    for (uint64_t i = 0; i < old_num; ++i)
+    {
+        if (0 == old_slots[i].off)
+            continue;
+        uint64_t j = old_slots[i].hash & mask;
+        while (new_slots[j].off)
+            j = (j + 1) & mask;
+        new_slots[j] = old_slots[i];
+    }
+    header()->slot_off = new_off;
+    header()->slot_num = old_num * 2;
+    return true;
+}
+
+bool mmap_store::find(const char *name, string &passwd)
+{
+    size_t len = strlen(name);
+    uint64_t h = hash_name(name, len);
+
+    m_lock.rdlock();
+    slot *s = probe(h, name, len);
+    bool hit = 0 != s->off;
+    if (hit)
+    {
+        record *r = record_at(s->off);
+        passwd.assign(r->data + r->name_len + 1, r->passwd_len);
+    }
+    m_lock.unlock();
+    return hit;
+}
+
+int mmap_store::add_user(const char *name, const char *passwd, store_cb cb, void *arg)
+{
+    size_t name_len = strlen(name);
+    size_t passwd_len = strlen(passwd);
+    if (name_len > UINT16_MAX || passwd_len > UINT16_MAX)
+        return STORE_ERROR;
+    uint64_t h = hash_name(name, name_len);
+
+    m_lock.wrlock();
+    if (probe(h, name, name_len)->off)
+    {
+        m_lock.unlock();
+        return STORE_DUP;
+    }
+    if ((header()->count + 1) * 2 > header()->slot_num && !rehash())
+    {
+        m_lock.unlock();
+        return STORE_ERROR;
+    }
+
+    uint64_t off = alloc(offsetof(record, data) + name_len + passwd_len + 2);
+    if (0 == off)
+    {
+        m_lock.unlock();
+        return STORE_ERROR;
+    }
+    record *r = record_at(off);
+    r->name_len = name_len;
+    r->passwd_len = passwd_len;
+    memcpy(r->data, name, name_len + 1);
+    memcpy(r->data + name_len + 1, passwd, passwd_len + 1);
+
+    //先写好记录再填槽，进程中途退出时最多留下一条无人引用的记录
+    slot *s = probe(h, name, name_len);
+    s->hash = h;
+    s->off = off;
+    ++header()->count;
+    m_lock.unlock();
+    return STORE_OK;
+}
+
+size_t mmap_store::size()
+{
+    m_lock.rdlock();
+    size_t n = header()->count;
+    m_lock.unlock();
+    return n;
+}
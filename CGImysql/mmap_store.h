@@ -0,0 +1,70 @@
+#ifndef MMAP_STORE_H
+#define MMAP_STORE_H
+
+#include <stdint.h>
+#include "user_store.h"
+#include "../lock/locker.h"
+#include "../log/log.h"
+
+/*************************************************************
+*本地文件后端：整个文件MAP_SHARED映射进内存，文件本身就是哈希表
+*布局：文件头 | 记录和槽数组，统一从文件尾部顺序分配
+*记录：name_len, passwd_len, name\0passwd\0，写入后不再修改
+*槽数组：开放寻址(线性探测)，负载超过一半时在尾部分配两倍大小的新数组重新散列，
+*       旧数组不再使用(不回收)
+*读写锁保护：查询共享，注册和扩容独占；文件扩大需要mremap，只在独占时进行
+**************************************************************/
+class mmap_store : public user_store
+{
+public:
+    mmap_store();
+    ~mmap_store();
+
+    //打开或创建存储文件，格式不符时返回false
+    bool init(const char *path, int close_log);
+
+    bool find(const char *name, string &passwd);
+    int add_user(const char *name, const char *passwd, store_cb cb, void *arg);
+    size_t size();
+
+private:
+    struct file_header
+    {
+        char magic[8];
+        uint64_t used;     //已分配到的偏移
+        uint64_t slot_off; //当前槽数组的偏移
+        uint64_t slot_num; //槽数，2的幂
+        uint64_t count;    //用户数
+    };
+    struct slot
+    {
+        uint64_t hash;
+        uint64_t off; //记录偏移，0表示空槽
+    };
+    struct record
+    {
+        uint16_t name_len;
+        uint16_t passwd_len;
+        char data[4]; //name\0passwd\0
+    };
+
+    file_header *header() const { return (file_header *)m_base; }
+    slot *slots() const { return (slot *)(m_base + header()->slot_off); }
+    record *record_at(uint64_t off) const { return (record *)(m_base + off); }
+
+    static uint64_t hash_name(const char *name, size_t len);
+    //在当前槽数组中查找，命中返回槽，否则返回应插入的空槽
+    slot *probe(uint64_t h, const char *name, size_t len) const;
+    //从文件尾部分配n字节(8字节对齐)，空间不足时扩大文件，返回偏移，失败返回0
+    uint64_t alloc(size_t n);
+    bool grow_file(uint64_t need);
+    bool rehash();
+
+    int m_fd;
+    char *m_base;
+    uint64_t m_size; //当前映射的长度
+    rwlocker m_lock;
+    int m_close_log;
+};
+
+#endif
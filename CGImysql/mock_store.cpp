@@ -0,0 +1,33 @@
+#include <string.h>
+#include <unistd.h>
+#include "mock_store.h"
+
+mock_store::mock_store(int latency_us)
+{
+    m_latency_us = latency_us;
+}
+
+void mock_store::delay()
+{
+    if (m_latency_us > 0)
+        usleep(m_latency_us);
+}
+
+bool mock_store::find(const char *name, string &passwd)
+{
+    delay();
+    return m_table.find(name, passwd);
+}
+
+int mock_store::add_user(const char *name, const char *passwd, store_cb cb, void *arg)
+{
+    delay();
+    if (strlen(name) > user_table::MAX_LEN || strlen(passwd) > user_table::MAX_LEN)
+        return STORE_ERROR;
+    return m_table.insert(name, passwd) ? STORE_OK : STORE_DUP;
+}
+
+size_t mock_store::size()
+{
+    return m_table.size();
+}
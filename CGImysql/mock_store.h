@@ -0,0 +1,25 @@
+#ifndef MOCK_STORE_H
+#define MOCK_STORE_H
+
+#include "user_store.h"
+#include "user_table.h"
+
+//替身后端：数据只在内存中，每次访问先阻塞latency_us微秒，模拟一次远端存储的往返
+//不依赖任何外部服务，用于压测和比较不同后端
+class mock_store : public user_store
+{
+public:
+    mock_store(int latency_us);
+
+    bool find(const char *name, string &passwd);
+    int add_user(const char *name, const char *passwd, store_cb cb, void *arg);
+    size_t size();
+
+private:
+    void delay();
+
+    user_table m_table;
+    int m_latency_us;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include <string.h>
+#include <mysql/mysql.h>
+#include "mysql_store.h"
+
+mysql_store::mysql_store(connection_pool *pool, async_sql *async, sql_batch *batch, int close_log)
+{
+    m_pool = pool;
+    m_async = async;
+    m_batch = batch;
+    m_close_log = close_log;
+}
+
+mysql_store::~mysql_store()
+{
+    delete m_batch;
+    delete m_async;
+}
+
+bool mysql_store::load()
+{
+    //先从连接池中取一个连接，离开作用域即归还
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_pool);
+    if (NULL == mysql)
+        return false;
+
+    //在user表中检索username，passwd数据
+    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
+    {
+        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        return false;
+    }
+
+    //从表中检索完整的结果集
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+        return false;
+
+    //从结果集中逐行取出用户名和密码，存入缓存中
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        m_cache.insert(row[0], row[1]);
+    }
+    mysql_free_result(result);
+    return true;
+}
+
+bool mysql_store::find(const char *name, string &passwd)
+{
+    return m_cache.find(name, passwd);
+}
+
+int mysql_store::add_user(const char *name, const char *passwd, store_cb cb, void *arg)
+{
+    if (strlen(name) > user_table::MAX_LEN || strlen(passwd) > user_table::MAX_LEN)
+        return STORE_ERROR;
+    //先在缓存中占住用户名，并发注册同名用户只有一个能成功
+    if (!m_cache.insert(name, passwd))
+        return STORE_DUP;
+
+    const char *params[2] = {name, passwd};
+    //配置了合并写入或异步客户端时，工作线程不等待数据库
+    if (m_batch || m_async)
+    {
+        add_ctx *ctx = new add_ctx;
+        ctx->store = this;
+        ctx->name = name;
+        ctx->cb = cb;
+        ctx->arg = arg;
+        if (m_batch ? m_batch->add(name, passwd, add_done, ctx)
+                    : m_async->exec(STMT_INSERT_USER, params, 2, add_done, ctx))
+            return STORE_PENDING;
+        delete ctx;
+    }
+
+    //只在真正需要写库时才从连接池取连接，离开作用域即归还
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_pool);
+    //使用连接上预先准备好的INSERT语句，用户名和密码作为参数绑定
+    int ret = m_pool->ExecStmt(mysql, STMT_INSERT_USER, params, 2);
+    if (ret)
+    {
+        //写库失败，撤销缓存中的占位
+        m_cache.erase(name);
+        return SQL_BUSY == ret ? STORE_BUSY : STORE_ERROR;
+    }
+    return STORE_OK;
+}
+
+void mysql_store::add_done(void *arg, int result)
+{
+    add_ctx *ctx = (add_ctx *)arg;
+    if (result)
+        ctx->store->m_cache.erase(ctx->name.c_str());
+    ctx->cb(ctx->arg, result ? (SQL_BUSY == result ? STORE_BUSY : STORE_ERROR) : STORE_OK);
+    delete ctx;
+}
+
+size_t mysql_store::size()
+{
+    return m_cache.size();
+}
+
+void mysql_store::attach(int epollfd)
+{
+    if (m_batch)
+        m_batch->attach(epollfd);
+    if (m_async)
+        m_async->attach(epollfd);
+}
+
+bool mysql_store::owns(int fd) const
+{
+    return (m_batch && m_batch->owns(fd)) || (m_async && m_async->owns(fd));
+}
+
+void mysql_store::handle_event(int fd, unsigned int events)
+{
+    if (m_batch && m_batch->owns(fd))
+        m_batch->handle_event(fd, events);
+    else
+        m_async->handle_event(fd, events);
+}
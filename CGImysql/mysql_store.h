@@ -0,0 +1,48 @@
+#ifndef MYSQL_STORE_H
+#define MYSQL_STORE_H
+
+#include "user_store.h"
+#include "user_table.h"
+#include "sql_connection_pool.h"
+#include "async_sql.h"
+#include "sql_batch.h"
+
+//MySQL后端：登录只查内存缓存，注册先在缓存中占住用户名再写库，写库失败时撤销
+class mysql_store : public user_store
+{
+public:
+    //注册写库方式：batch不为NULL时合并写入，否则async不为NULL时交给主线程的异步客户端，
+    //都为NULL时在工作线程中同步写库；batch和async由本对象负责释放
+    mysql_store(connection_pool *pool, async_sql *async, sql_batch *batch, int close_log);
+    ~mysql_store();
+
+    //把user表整表读入缓存
+    bool load();
+
+    bool find(const char *name, string &passwd);
+    int add_user(const char *name, const char *passwd, store_cb cb, void *arg);
+    size_t size();
+
+    void attach(int epollfd);
+    bool owns(int fd) const;
+    void handle_event(int fd, unsigned int events);
+
+private:
+    //异步写库的上下文，回调时用于回滚缓存并通知调用方
+    struct add_ctx
+    {
+        mysql_store *store;
+        string name;
+        store_cb cb;
+        void *arg;
+    };
+    static void add_done(void *arg, int result);
+
+    user_table m_cache;
+    connection_pool *m_pool;
+    async_sql *m_async;
+    sql_batch *m_batch;
+    int m_close_log;
+};
+
+#endif
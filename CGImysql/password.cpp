@@ -0,0 +1,101 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include "password.h"
+
+static const char PREFIX[] = "$pbkdf2-sha256$";
+static const int SALT_LEN = 16;
+static const int HASH_LEN = 32;
+
+static void to_hex(const unsigned char *data, int len, string &out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < len; ++i)
+    {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 15];
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+//解码定长的hex串，长度或字符不符返回false
+static bool from_hex(const char *hex, size_t hex_len, unsigned char *out, int len)
+{
+    if (hex_len != (size_t)len * 2)
+        return false;
+    for (int i = 0; i < len; ++i)
+    {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hex_value(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out[i] = hi << 4 | lo;
+    }
+    return true;
+}
+
+static bool derive(const char *passwd, const unsigned char *salt, int iter, unsigned char *out)
+{
+    return PKCS5_PBKDF2_HMAC(passwd, strlen(passwd), salt, SALT_LEN, iter, EVP_sha256(), HASH_LEN, out) == 1;
+}
+
+bool password_is_hashed(const string &stored)
+{
+    return stored.compare(0, sizeof(PREFIX) - 1, PREFIX) == 0;
+}
+
+string password_hash(const char *passwd, int iter)
+{
+    if (iter <= 0)
+        return passwd;
+
+    unsigned char salt[SALT_LEN], hash[HASH_LEN];
+    if (RAND_bytes(salt, SALT_LEN) != 1 || !derive(passwd, salt, iter, hash))
+        return "";
+
+    char head[64];
+    snprintf(head, sizeof(head), "%s%d$", PREFIX, iter);
+    string stored = head;
+    to_hex(salt, SALT_LEN, stored);
+    stored += '$';
+    to_hex(hash, HASH_LEN, stored);
+    return stored;
+}
+
+bool password_verify(const char *passwd, const string &stored)
+{
+    //旧的明文记录
+    if (!password_is_hashed(stored))
+        return stored.size() == strlen(passwd) && CRYPTO_memcmp(stored.c_str(), passwd, stored.size()) == 0;
+
+    //迭代次数$盐$哈希
+    const char *p = stored.c_str() + sizeof(PREFIX) - 1;
+    char *end;
+    long iter = strtol(p, &end, 10);
+    if (end == p || *end != '$' || iter <= 0 || iter > 100000000)
+        return false;
+    const char *salt_hex = end + 1;
+    const char *hash_hex = strchr(salt_hex, '$');
+    if (!hash_hex)
+        return false;
+    ++hash_hex;
+
+    unsigned char salt[SALT_LEN], expect[HASH_LEN], hash[HASH_LEN];
+    if (!from_hex(salt_hex, hash_hex - 1 - salt_hex, salt, SALT_LEN) ||
+        !from_hex(hash_hex, strlen(hash_hex), expect, HASH_LEN))
+        return false;
+    if (!derive(passwd, salt, iter, hash))
+        return false;
+    return CRYPTO_memcmp(hash, expect, HASH_LEN) == 0;
+}
@@ -0,0 +1,23 @@
+#ifndef PASSWORD_H
+#define PASSWORD_H
+
+#include <string>
+
+using namespace std;
+
+/*************************************************************
+*口令加盐哈希：PBKDF2-HMAC-SHA256，每个用户16字节随机盐
+*存储格式：$pbkdf2-sha256$迭代次数$盐(hex)$哈希(hex)，共118字节左右
+*不以$pbkdf2-sha256$开头的旧记录按明文比较，升级前注册的用户仍能登录
+**************************************************************/
+
+//生成口令的存储串，iter为0时原样返回明文
+string password_hash(const char *passwd, int iter);
+
+//按存储串中的参数重新计算并比较，比较耗时与内容无关
+bool password_verify(const char *passwd, const string &stored);
+
+//存储串是否为哈希格式，即校验是否需要耗费CPU
+bool password_is_hashed(const string &stored);
+
+#endif
@@ -0,0 +1,197 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <vector>
+#include "sql_batch.h"
+
+//当前时间，微秒
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+sql_batch::sql_batch()
+{
+    m_pool = NULL;
+    m_max_batch = 1;
+    m_max_delay_ms = 0;
+    m_close_log = 0;
+    m_stop = false;
+    m_started = false;
+    m_done_fd = -1;
+}
+
+sql_batch::~sql_batch()
+{
+    //后台线程写完队列中剩余的注册后退出
+    if (m_started)
+    {
+        m_lock.lock();
+        m_stop = true;
+        m_cond.broadcast();
+        m_lock.unlock();
+        pthread_join(m_thread, NULL);
+    }
+    if (m_done_fd >= 0)
+        close(m_done_fd);
+}
+
+bool sql_batch::init(connection_pool *pool, int max_batch, int max_delay_ms, int close_log)
+{
+    m_pool = pool;
+    m_max_batch = max_batch > 0 ? max_batch : 1;
+    m_max_delay_ms = max_delay_ms > 0 ? max_delay_ms : 0;
+    m_close_log = close_log;
+
+    m_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_done_fd < 0)
+        return false;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+        return false;
+    m_started = true;
+    return true;
+}
+
+void sql_batch::attach(int epollfd)
+{
+    epoll_event event;
+    event.data.fd = m_done_fd;
+    event.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, m_done_fd, &event);
+}
+
+bool sql_batch::add(const char *name, const char *passwd, sql_cb cb, void *arg)
+{
+    batch_item item;
+    item.name = name;
+    item.passwd = passwd;
+    item.cb = cb;
+    item.arg = arg;
+    item.result = 0;
+    item.enqueue_us = now_us();
+
+    m_lock.lock();
+    if (m_stop)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    m_pending.push_back(item);
+    //队列由空变非空时唤醒空闲的后台线程，攒满一批时不必再等
+    if (1 == m_pending.size() || (int)m_pending.size() >= m_max_batch)
+        m_cond.signal();
+    m_lock.unlock();
+    return true;
+}
+
+void *sql_batch::worker(void *arg)
+{
+    sql_batch *batch = (sql_batch *)arg;
+    batch->run();
+    return NULL;
+}
+
+void sql_batch::run()
+{
+    while (true)
+    {
+        m_lock.lock();
+        while (m_pending.empty() && !m_stop)
+            m_cond.wait(m_lock.get());
+        if (m_pending.empty())
+        {
+            m_lock.unlock();
+            break;
+        }
+
+        //最早的一条最多等待max_delay毫秒
+        long long deadline = m_pending.front().enqueue_us + m_max_delay_ms * 1000LL;
+        while (!m_stop && (int)m_pending.size() < m_max_batch)
+        {
+            if (now_us() >= deadline)
+                break;
+            struct timespec t;
+            t.tv_sec = deadline / 1000000;
+            t.tv_nsec = deadline % 1000000 * 1000;
+            m_cond.timewait(m_lock.get(), t);
+        }
+
+        list<batch_item> batch;
+        list<batch_item>::iterator last = m_pending.begin();
+        for (int i = 0; i < m_max_batch && last != m_pending.end(); ++i)
+            ++last;
+        batch.splice(batch.end(), m_pending, m_pending.begin(), last);
+        m_lock.unlock();
+
+        flush(batch);
+
+        m_lock.lock();
+        m_done.splice(m_done.end(), batch);
+        m_lock.unlock();
+
+        uint64_t one = 1;
+        ssize_t ret = write(m_done_fd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+void sql_batch::flush(list<batch_item> &batch)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_pool);
+
+    //单条语句在InnoDB自动提交下是原子的，整批要么全部写入要么全部失败
+    if (mysql && batch.size() > 1 && insert_rows(mysql, batch))
+        return;
+
+    //只有一条，或整批失败(如用户名冲突)时逐条写入，得到每条各自的结果
+    for (list<batch_item>::iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        const char *params[2] = {it->name.c_str(), it->passwd.c_str()};
+        it->result = m_pool->ExecStmt(mysql, STMT_INSERT_USER, params, 2);
+    }
+}
+
+bool sql_batch::insert_rows(MYSQL *mysql, list<batch_item> &batch)
+{
+    string sql = "INSERT INTO user(username, passwd) VALUES";
+    vector<char> buf;
+    for (list<batch_item>::iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        sql += it == batch.begin() ? "('" : ",('";
+        buf.resize(it->name.size() * 2 + 1);
+        sql.append(&buf[0], mysql_real_escape_string(mysql, &buf[0], it->name.c_str(), it->name.size()));
+        sql += "','";
+        buf.resize(it->passwd.size() * 2 + 1);
+        sql.append(&buf[0], mysql_real_escape_string(mysql, &buf[0], it->passwd.c_str(), it->passwd.size()));
+        sql += "')";
+    }
+
+    if (mysql_real_query(mysql, sql.c_str(), sql.size()))
+    {
+        LOG_WARN("batch insert of %d users error:%s", (int)batch.size(), mysql_error(mysql));
+        return false;
+    }
+    for (list<batch_item>::iterator it = batch.begin(); it != batch.end(); ++it)
+        it->result = 0;
+    return true;
+}
+
+void sql_batch::handle_event(int fd, unsigned int events)
+{
+    uint64_t count;
+    ssize_t ret = read(m_done_fd, &count, sizeof(count));
+    (void)ret;
+
+    list<batch_item> done;
+    m_lock.lock();
+    done.swap(m_done);
+    m_lock.unlock();
+
+    for (list<batch_item>::iterator it = done.begin(); it != done.end(); ++it)
+        it->cb(it->arg, it->result);
+}
@@ -0,0 +1,71 @@
+#ifndef SQL_BATCH_H
+#define SQL_BATCH_H
+
+#include <list>
+#include <string>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "../log/log.h"
+#include "sql_connection_pool.h"
+#include "async_sql.h"
+
+using namespace std;
+
+/*************************************************************
+*注册写库的合并队列(write-behind)
+*工作线程只把(用户名, 密码)放入队列，后台线程攒够max_batch条，
+*或最早的一条已等待max_delay毫秒时，用一条多行INSERT一次写入
+*整批失败时逐条重试，区分出具体是哪条失败
+*完成结果经eventfd交回主线程，在主线程中回调，与异步客户端的约定一致
+**************************************************************/
+class sql_batch
+{
+public:
+    sql_batch();
+    ~sql_batch();
+
+    bool init(connection_pool *pool, int max_batch, int max_delay_ms, int close_log);
+    //将唤醒用的eventfd注册到主线程的epoll
+    void attach(int epollfd);
+
+    //任意线程调用：排队写入一条用户，提交后cb(arg, result)在主线程中调用，result为0表示成功
+    bool add(const char *name, const char *passwd, sql_cb cb, void *arg);
+
+    bool owns(int fd) const { return fd >= 0 && fd == m_done_fd; }
+    //主线程调用：回调已提交的结果
+    void handle_event(int fd, unsigned int events);
+
+private:
+    struct batch_item
+    {
+        string name;
+        string passwd;
+        sql_cb cb;
+        void *arg;
+        int result;
+        long long enqueue_us;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    //执行一批写入，结果填入各条的result
+    void flush(list<batch_item> &batch);
+    //多行INSERT，成功返回true
+    bool insert_rows(MYSQL *mysql, list<batch_item> &batch);
+
+    connection_pool *m_pool;
+    int m_max_batch;
+    int m_max_delay_ms;
+    int m_close_log;
+
+    locker m_lock;             //保护m_pending、m_done和m_stop
+    cond m_cond;
+    list<batch_item> m_pending; //等待写入
+    list<batch_item> m_done;    //已写入，等待主线程回调
+    bool m_stop;
+    pthread_t m_thread;
+    bool m_started;
+    int m_done_fd;
+};
+
+#endif
@@ -6,14 +6,36 @@
 #include <list>
 #include <pthread.h>
 #include <iostream>
+#include <sys/time.h>
 #include "sql_connection_pool.h"
 
 using namespace std;
 
+//空闲超过该时间(微秒)的连接取出时先用mysql_ping校验，刚放回的连接直接使用
+static const long long VALIDATE_IDLE_US = 1000000;
+//维护线程的检查间隔(秒)和统计输出间隔(次)
+static const int MAINTAIN_INTERVAL = 1;
+static const int STATS_EVERY = 60;
+
+//当前时间，微秒
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
 connection_pool::connection_pool()
 {
+	m_MinConn = 0;
+	m_MaxConn = 0;
 	m_CurConn = 0;
 	m_FreeConn = 0;
+	m_Creating = 0;
+	m_IdleTimeout = 60;
+	m_AcquireTimeout = 0;
+	m_running = false;
+	memset(&m_stats, 0, sizeof(m_stats));
 }
 
 connection_pool *connection_pool::GetInstance()
@@ -22,69 +44,214 @@ connection_pool *connection_pool::GetInstance()
 	return &connPool;
 }
 
+const char *stmt_sql[STMT_NUM] = {
+    "INSERT INTO user(username, passwd) VALUES(?, ?)"};
+
 // 初始化连接池
 void connection_pool::init(string url, string User, string PassWord,
-                           string DBName, int Port, unsigned int MaxConn)
+                           string DBName, int Port, int MinConn, int MaxConn, int close_log,
+                           int idle_timeout, int acquire_timeout)
 {
     // 初始化数据库信息
-    this->url = url; // 数据库地址
-    this->Port = Port; // 数据库端口
-    this->User = User; // 用户名
-    this->PassWord = PassWord; // 密码
-    this->DatabaseName = DBName; // 数据库名称
- 
-    // 创建 MaxConn 条数据库连接
-    for (int i = 0; i < MaxConn; i++) {
-        MYSQL *con = NULL; // MySQL 连接指针
-        con = mysql_init(con); // 初始化连接
- 
+    m_url = url; // 数据库地址
+    m_Port = Port; // 数据库端口
+    m_User = User; // 用户名
+    m_PassWord = PassWord; // 密码
+    m_DatabaseName = DBName; // 数据库名称
+    m_close_log = close_log;
+    m_MaxConn = MaxConn > 0 ? MaxConn : 1;
+    m_MinConn = MinConn < 0 ? 0 : (MinConn > m_MaxConn ? m_MaxConn : MinConn);
+    m_IdleTimeout = idle_timeout;
+    m_AcquireTimeout = acquire_timeout;
+
+    // 先建立 MinConn 条连接，失败不退出，之后按需建立或由维护线程补齐
+    for (int i = 0; i < m_MinConn; i++) {
+        MYSQL *con = CreateConnection();
+
+        lock.lock();
         if (con == NULL) {
-            cout << "Error:" << mysql_error(con); // 输出错误信息
-            exit(1); // 退出程序
+            ++m_stats.failed;
+        } else {
+            idle_conn idle = {con, now_us()};
+            connList.push_back(idle); // 将连接添加到连接池列表
+            ++m_FreeConn; // 空闲连接数加一
+            ++m_stats.created;
         }
-        con = mysql_real_connect(con, url.c_Str(), User.c_str(),
-                                 DBName.c_str(), Port, NULL, 0); // 连接数据库
- 
-        if (con == NULL) {
-            cout << "Error: " << mysql_error(con); // 输出错误信息
-            exit(1); // 退出程序
+        lock.unlock();
+    }
+    if (m_FreeConn < m_MinConn)
+        LOG_ERROR("MySQL pool started with %d of %d connections", m_FreeConn, m_MinConn);
+
+    m_running = true;
+    if (pthread_create(&m_maintain_tid, NULL, maintain_thread, this) != 0)
+        m_running = false;
+}
+
+MYSQL *connection_pool::CreateConnection()
+{
+    MYSQL *con = NULL; // MySQL 连接指针
+    con = mysql_init(con); // 初始化连接
+    if (con == NULL)
+        return NULL;
+
+    if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(),
+                           m_DatabaseName.c_str(), m_Port, NULL, 0) == NULL) {
+        LOG_ERROR("MySQL connect error:%s", mysql_error(con));
+        mysql_close(con);
+        return NULL;
+    }
+
+    // 预处理语句随连接一起创建，之后每次执行只需绑定参数
+    MYSQL_STMT **stmts = new MYSQL_STMT *[STMT_NUM];
+    for (int i = 0; i < STMT_NUM; ++i) {
+        stmts[i] = mysql_stmt_init(con);
+        if (stmts[i] && mysql_stmt_prepare(stmts[i], stmt_sql[i], strlen(stmt_sql[i]))) {
+            LOG_ERROR("prepare \"%s\" error:%s", stmt_sql[i], mysql_stmt_error(stmts[i]));
+            mysql_stmt_close(stmts[i]);
+            stmts[i] = NULL;
         }
- 
-        // 更新连接池和空闲连接数量
-        connList.push_back(con); // 将连接添加到连接池列表
-        ++FreeConn; // 空闲连接数加一
     }
- 
-    // 信号量初始化为最大连接数
-    reserve = sem(FreeConn);
- 
-    this->MaxConn = FreeConn; // 最大连接数等于空闲连接数
+
+    lock.lock();
+    m_stmts[con] = stmts;
+    lock.unlock();
+    return con;
+}
+
+void connection_pool::CloseConnection(MYSQL *con)
+{
+    lock.lock();
+    map<MYSQL *, MYSQL_STMT **>::iterator it = m_stmts.find(con);
+    MYSQL_STMT **stmts = NULL;
+    if (it != m_stmts.end()) {
+        stmts = it->second;
+        m_stmts.erase(it);
+    }
+    lock.unlock();
+
+    if (stmts) {
+        for (int i = 0; i < STMT_NUM; ++i)
+            if (stmts[i])
+                mysql_stmt_close(stmts[i]);
+        delete[] stmts;
+    }
+    mysql_close(con);
+}
+
+MYSQL_STMT *connection_pool::GetStmt(MYSQL *con, int id)
+{
+    if (NULL == con || id < 0 || id >= STMT_NUM)
+        return NULL;
+
+    MYSQL_STMT *stmt = NULL;
+    lock.lock();
+    map<MYSQL *, MYSQL_STMT **>::iterator it = m_stmts.find(con);
+    if (it != m_stmts.end())
+        stmt = it->second[id];
+    lock.unlock();
+    return stmt;
+}
+
+int connection_pool::ExecStmt(MYSQL *con, int id, const char **params, int n)
+{
+    if (NULL == con)
+        return SQL_BUSY;
+    MYSQL_STMT *stmt = GetStmt(con, id);
+    if (NULL == stmt)
+        return -1;
+
+    //参数按原样以二进制协议发送，无需拼接和转义
+    MYSQL_BIND bind[8];
+    unsigned long length[8];
+    if (n > 8)
+        return -1;
+    memset(bind, 0, sizeof(bind));
+    for (int i = 0; i < n; ++i) {
+        length[i] = strlen(params[i]);
+        bind[i].buffer_type = MYSQL_TYPE_STRING;
+        bind[i].buffer = (void *)params[i];
+        bind[i].buffer_length = length[i];
+        bind[i].length = &length[i];
+    }
+
+    if (mysql_stmt_bind_param(stmt, bind) || mysql_stmt_execute(stmt)) {
+        int err = mysql_stmt_errno(stmt);
+        LOG_ERROR("execute \"%s\" error:%s", stmt_sql[id], mysql_stmt_error(stmt));
+        return err ? err : -1;
+    }
+    return 0;
 }
 
 
 // 当有请求时，从数据库连接池返回一个可用连接，
-// 更新使用和空闲连接数
+// 没有空闲连接时，未到上限则新建一条，否则等待其他线程归还，最多等待 m_AcquireTimeout 毫秒
 MYSQL *connection_pool::GetConnection()
 {
-    MYSQL *con = NULL; // MySQL 连接指针
- 
-    if (0 == connList.size()) // 如果连接池为空，返回空指针
-        return NULL;
- 
-    // 取出连接，信号量原子 -1，为 0 则等待
-    reserve.wait(); // 等待信号量
- 
+    long long start = now_us();
+    long long deadline = start + m_AcquireTimeout * 1000LL;
+
     lock.lock(); // 加锁
- 
-    con = connList.front(); // 获取连接池中的第一个连接
-    connList.pop_front(); // 弹出连接
- 
-    // 这里两个变量，没有用到，鸡肋啊...
-    --FreeConn; // 空闲连接数减一
-    ++CurConn; // 当前连接数加一
- 
-    lock.unlock(); // 解锁
-    return con; // 返回连接
+    while (true) {
+        if (!connList.empty()) {
+            // 取最近放回的连接，最久未用的留在尾部等待回收
+            idle_conn idle = connList.front();
+            connList.pop_front();
+            --m_FreeConn; // 空闲连接数减一
+            ++m_CurConn; // 当前连接数加一
+            lock.unlock();
+
+            // 空闲较久的连接可能已被服务端断开，取出前校验
+            if (now_us() - idle.since < VALIDATE_IDLE_US || 0 == mysql_ping(idle.conn)) {
+                record_wait(now_us() - start);
+                return idle.conn;
+            }
+
+            LOG_WARN("drop broken MySQL connection:%s", mysql_error(idle.conn));
+            CloseConnection(idle.conn);
+            lock.lock();
+            --m_CurConn;
+            ++m_stats.broken;
+            continue;
+        }
+
+        if (m_CurConn + m_FreeConn + m_Creating < m_MaxConn) {
+            // 未到上限，在锁外新建一条连接
+            ++m_Creating;
+            lock.unlock();
+            MYSQL *con = CreateConnection();
+            lock.lock();
+            --m_Creating;
+            if (con == NULL) {
+                // 数据库不可用时立即失败，不让工作线程继续等待
+                ++m_stats.failed;
+                m_free_cond.signal();
+                lock.unlock();
+                return NULL;
+            }
+            ++m_stats.created;
+            ++m_CurConn;
+            lock.unlock();
+            record_wait(now_us() - start);
+            return con;
+        }
+
+        // 已到上限，等待归还
+        if (m_AcquireTimeout <= 0) {
+            m_free_cond.wait(lock.get());
+            continue;
+        }
+        long long now = now_us();
+        if (now >= deadline) {
+            ++m_stats.timeouts;
+            lock.unlock();
+            LOG_WARN("wait for MySQL connection timeout after %d ms", m_AcquireTimeout);
+            return NULL;
+        }
+        struct timespec t;
+        t.tv_sec = deadline / 1000000;
+        t.tv_nsec = deadline % 1000000 * 1000;
+        m_free_cond.timewait(lock.get(), t);
+    }
 }
  
 // 释放当前使用的连接
@@ -95,41 +262,133 @@ bool connection_pool::ReleaseConnection(MYSQL *con)
  
     lock.lock(); // 加锁
  
-    connList.push_back(con); // 将连接放回连接池
-    ++FreeConn; // 空闲连接数加一
-    --CurConn; // 当前连接数减一
+    idle_conn idle = {con, now_us()};
+    connList.push_front(idle); // 将连接放回连接池头部
+    ++m_FreeConn; // 空闲连接数加一
+    --m_CurConn; // 当前连接数减一
+    m_free_cond.signal(); // 唤醒一个等待的线程
  
     lock.unlock(); // 解锁
- 
-    // 释放连接原子 +1
-    reserve.post(); // 释放信号量
     return true; // 返回true
 }
 
+// 记录一次成功获取的等待时间
+void connection_pool::record_wait(long long wait_us)
+{
+    int bucket = 0;
+    while (bucket < POOL_WAIT_BUCKETS - 1 && (1LL << bucket) <= wait_us)
+        ++bucket;
+
+    lock.lock();
+    ++m_stats.acquires;
+    ++m_stats.wait_hist[bucket];
+    lock.unlock();
+}
+
+void connection_pool::GetStats(pool_stats &stats)
+{
+    lock.lock();
+    stats = m_stats;
+    stats.in_use = m_CurConn;
+    stats.idle = m_FreeConn;
+    lock.unlock();
+}
+
+void *connection_pool::maintain_thread(void *args)
+{
+    connection_pool *pool = (connection_pool *)args;
+    pool->maintain();
+    return NULL;
+}
+
+void connection_pool::maintain()
+{
+    int rounds = 0;
+    lock.lock();
+    while (m_running) {
+        struct timespec t;
+        t.tv_sec = time(NULL) + MAINTAIN_INTERVAL;
+        t.tv_nsec = 0;
+        m_maintain_cond.timewait(lock.get(), t);
+        if (!m_running)
+            break;
+
+        // 从尾部回收空闲超过 m_IdleTimeout 秒的连接，至少保留 m_MinConn 条
+        list<MYSQL *> reap;
+        long long expire = now_us() - m_IdleTimeout * 1000000LL;
+        while (!connList.empty() && m_CurConn + m_FreeConn > m_MinConn && connList.back().since < expire) {
+            reap.push_back(connList.back().conn);
+            connList.pop_back();
+            --m_FreeConn;
+            ++m_stats.reaped;
+        }
+        // 连接断开或启动时建立失败导致不足 m_MinConn 时补齐一条
+        bool refill = m_CurConn + m_FreeConn + m_Creating < m_MinConn;
+        if (refill)
+            ++m_Creating;
+        lock.unlock();
+
+        for (list<MYSQL *>::iterator it = reap.begin(); it != reap.end(); ++it)
+            CloseConnection(*it);
+        MYSQL *con = refill ? CreateConnection() : NULL;
+
+        lock.lock();
+        if (refill) {
+            --m_Creating;
+            if (con) {
+                idle_conn idle = {con, now_us()};
+                connList.push_front(idle);
+                ++m_FreeConn;
+                ++m_stats.created;
+                m_free_cond.signal();
+            } else {
+                ++m_stats.failed;
+            }
+        }
+
+        if (++rounds % STATS_EVERY == 0) {
+            // 由直方图估算等待时间的 p50/p99 上界
+            unsigned long long seen = 0, p50 = 0, p99 = 0;
+            for (int i = 0; i < POOL_WAIT_BUCKETS; ++i) {
+                seen += m_stats.wait_hist[i];
+                if (!p50 && seen * 2 >= m_stats.acquires)
+                    p50 = 1ULL << i;
+                if (!p99 && seen * 100 >= m_stats.acquires * 99)
+                    p99 = 1ULL << i;
+            }
+            LOG_INFO("MySQL pool: in_use %d idle %d acquires %llu created %llu failed %llu timeouts %llu broken %llu reaped %llu wait p50<%lluus p99<%lluus",
+                     m_CurConn, m_FreeConn, m_stats.acquires, m_stats.created, m_stats.failed,
+                     m_stats.timeouts, m_stats.broken, m_stats.reaped, p50, p99);
+        }
+    }
+    lock.unlock();
+}
+
 
 // 销毁数据库连接池
 void connection_pool::DestroyPool()
 {
     lock.lock(); // 加锁
-    if (connList.size() > 0) { // 如果连接池不为空
-        // 迭代器遍历，关闭数据库连接
-        list<MYSQL *>::iterator it; // 声明迭代器it，用于遍历connList列表
-        for (it = connList.begin(); it != connList.end(); ++it) // 遍历连接池中的每个连接
-        {
-            MYSQL *con = *it; // 获取迭代器指向的连接
-            mysql_close(con); // 关闭数据库连接
-        }
-        CurConn = 0; // 将当前连接数设置为0
-        FreeConn = 0; // 将空闲连接数设置为0
- 
-        // 清空list
-        connList.clear(); // 清空连接池列表
- 
-        lock.unlock(); // 解锁
-    }
- 
-    // 无论是否进入 if 分支，都能正确释放互斥锁
+    bool running = m_running;
+    m_running = false; // 通知维护线程退出
+    m_maintain_cond.signal();
+    lock.unlock();
+    if (running)
+        pthread_join(m_maintain_tid, NULL);
+
+    lock.lock(); // 加锁
+    list<idle_conn> conns;
+    conns.swap(connList); // 取出所有连接，关闭时不持有锁（CloseConnection 内部会加锁）
+    m_CurConn = 0; // 将当前连接数设置为0
+    m_FreeConn = 0; // 将空闲连接数设置为0
     lock.unlock(); // 解锁
+
+    // 迭代器遍历，关闭数据库连接
+    list<idle_conn>::iterator it; // 声明迭代器it，用于遍历connList列表
+    for (it = conns.begin(); it != conns.end(); ++it) // 遍历连接池中的每个连接
+    {
+        CloseConnection(it->conn); // 关闭预处理语句和数据库连接
+    }
 }
 
 //当前空闲的连接数
@@ -8,39 +8,103 @@
 #include <string.h>
 #include <iostream>
 #include <string>
+#include <map>
 #include "../lock/locker.h"
 #include "../log/log.h"
 
 using namespace std;
 
+//每条连接建立时预先准备好的语句，执行时只传参数，服务端不再重复解析SQL
+enum SQL_STMT
+{
+	STMT_INSERT_USER = 0, //INSERT INTO user(username, passwd) VALUES(?, ?)
+	STMT_NUM
+};
+//预处理语句的SQL，与SQL_STMT一一对应
+extern const char *stmt_sql[STMT_NUM];
+
+//没有拿到连接(等待超时或数据库不可用)时ExecStmt返回的错误码
+const int SQL_BUSY = -2;
+
+//获取连接等待时间直方图的桶数，第i个桶统计等待时间小于2^i微秒的次数
+const int POOL_WAIT_BUCKETS = 25;
+
+//连接池统计
+struct pool_stats
+{
+	int in_use;					  //正在使用的连接数
+	int idle;					  //空闲连接数
+	unsigned long long acquires;  //成功获取次数
+	unsigned long long created;	  //新建连接数
+	unsigned long long failed;	  //建立连接失败次数
+	unsigned long long timeouts;  //等待超时次数
+	unsigned long long broken;	  //校验(mysql_ping)失败被丢弃的连接数
+	unsigned long long reaped;	  //空闲过久被回收的连接数
+	unsigned long long wait_hist[POOL_WAIT_BUCKETS];
+};
+
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 //获取数据库连接
+	MYSQL *GetConnection();				 //获取数据库连接，超时或无法建立连接时返回NULL
 	bool ReleaseConnection(MYSQL *conn); //释放连接
 	int GetFreeConn();					 //获取空闲连接的数量
 	void DestroyPool();					 //销毁所有连接
+	void GetStats(pool_stats &stats);	 //获取统计信息
+
+	//获取conn上编号为id的预处理语句，准备失败时为NULL
+	MYSQL_STMT *GetStmt(MYSQL *conn, int id);
+	//以二进制协议绑定n个字符串参数并执行预处理语句，成功返回0，conn为NULL时返回SQL_BUSY，否则返回错误码
+	int ExecStmt(MYSQL *conn, int id, const char **params, int n);
 
 	//单例模式
 	static connection_pool *GetInstance();
 
+	//启动时建立MinConn条连接，不够用时按需增长到MaxConn条
+	//空闲超过idle_timeout秒的连接在多于MinConn时被回收
+	//获取连接最多等待acquire_timeout毫秒，0表示一直等待
 	void init(string url, string User, string PassWord, 
-		string DataBaseName, int Port, int MaxConn, int close_log); 
+		string DataBaseName, int Port, int MinConn, int MaxConn, int close_log,
+		int idle_timeout = 60, int acquire_timeout = 1000); 
 
 private:
 	connection_pool();
 	~connection_pool();
 
+	//建立一条连接并准备好所有预处理语句，失败返回NULL
+	MYSQL *CreateConnection();
+	void CloseConnection(MYSQL *conn);
+	//维护线程：回收空闲过久的连接，连接数不足MinConn时补齐，定期输出统计
+	static void *maintain_thread(void *args);
+	void maintain();
+	void record_wait(long long wait_us);
+
+	//空闲连接及其放回的时间
+	struct idle_conn
+	{
+		MYSQL *conn;
+		long long since; //微秒
+	};
+
+	int m_MinConn;  //最少保持的连接数
 	int m_MaxConn;  //最大连接数
 	int m_CurConn;  //当前已使用的连接数
 	int m_FreeConn; //当前空闲的连接数
+	int m_Creating; //正在建立的连接数，计入总数以免并发建立超过上限
+	int m_IdleTimeout;	  //空闲回收时间，秒
+	int m_AcquireTimeout; //获取连接的等待上限，毫秒
 	locker lock;
-	list<MYSQL *> connList; //连接池
-	sem reserve;
+	cond m_free_cond;		//有连接放回或名额空出
+	cond m_maintain_cond;	//唤醒维护线程退出
+	list<idle_conn> connList; //连接池，头部是最近放回的连接
+	map<MYSQL *, MYSQL_STMT **> m_stmts; //各连接的预处理语句
+	pool_stats m_stats;
+	pthread_t m_maintain_tid;
+	bool m_running;
 
 public:
 	string m_url;			 //主机地址
-	string m_Port;		 //数据库端口号
+	int m_Port;		 //数据库端口号
 	string m_User;		 //登陆数据库用户名
 	string m_PassWord;	 //登陆数据库密码
 	string m_DatabaseName; //使用数据库名
@@ -0,0 +1,44 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+//add_user异步完成时的回调，result为user_store::STORE_OK/STORE_DUP/STORE_ERROR
+typedef void (*store_cb)(void *arg, int result);
+
+/*************************************************************
+*用户凭据存储接口，登录和注册只通过它访问用户数据
+*mysql: 连接池(可选异步客户端)写库，启动时整表读入内存缓存
+*mmap : 进程内的文件哈希表，不依赖数据库
+*mock : 纯内存表，可注入固定延迟模拟远端存储，用于压测
+**************************************************************/
+class user_store
+{
+public:
+    enum STORE_RESULT
+    {
+        STORE_OK = 0,
+        STORE_DUP,     //用户名已存在
+        STORE_ERROR,   //后端写入失败
+        STORE_BUSY,    //后端暂时不可用(如等不到数据库连接)，可稍后重试
+        STORE_PENDING  //已提交给异步组件，结果稍后回调
+    };
+
+    virtual ~user_store() {}
+
+    //查询用户，找到时将保存的密码拷贝到passwd，工作线程并发调用
+    virtual bool find(const char *name, string &passwd) = 0;
+    //添加用户，返回STORE_PENDING时cb(arg, result)稍后在主线程中调用，否则不会调用cb
+    virtual int add_user(const char *name, const char *passwd, store_cb cb, void *arg) = 0;
+    virtual size_t size() = 0;
+
+    //需要主线程事件循环驱动的后端(异步数据库)重写以下三个接口
+    virtual void attach(int epollfd) {}
+    virtual bool owns(int fd) const { return false; }
+    virtual void handle_event(int fd, unsigned int events) {}
+};
+
+#endif
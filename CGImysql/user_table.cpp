@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "user_table.h"
+
+//每个分片初始的桶数，平均每桶超过一个节点时翻倍
+static const size_t INIT_BUCKETS = 256;
+//扩容时链表会被重新串接，读者最多走这么多步，超出说明读到了中间状态
+static const int MAX_PROBE = 1 << 16;
+//节点最小容量
+static const size_t MIN_NODE_CAP = 32;
+
+user_table::user_table(int shard_bits)
+{
+    m_shard_num = 1 << shard_bits;
+    m_shift = 64 - shard_bits;
+    m_shards = new shard[m_shard_num];
+    for (int i = 0; i < m_shard_num; ++i)
+    {
+        m_shards[i].seq.store(0);
+        m_shards[i].table.store(new_buckets(INIT_BUCKETS));
+        m_shards[i].count = 0;
+    }
+}
+
+user_table::~user_table()
+{
+    for (int i = 0; i < m_shard_num; ++i)
+    {
+        bucket_array *arr = m_shards[i].table.load();
+        for (size_t b = 0; b <= arr->mask; ++b)
+        {
+            node *n = arr->slot[b].load();
+            while (n)
+            {
+                node *next = n->next.load();
+                free(n);
+                n = next;
+            }
+        }
+        free(arr);
+        for (size_t j = 0; j < m_shards[i].retired.size(); ++j)
+            free(m_shards[i].retired[j]);
+        for (size_t j = 0; j < m_shards[i].spare.size(); ++j)
+            free(m_shards[i].spare[j]);
+    }
+    delete[] m_shards;
+}
+
+//FNV-1a，高位选分片，低位选桶
+uint64_t user_table::hash_name(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+user_table::bucket_array *user_table::new_buckets(size_t n)
+{
+    bucket_array *arr = (bucket_array *)malloc(sizeof(bucket_array) + (n - 1) * sizeof(std::atomic<node *>));
+    arr->mask = n - 1;
+    for (size_t i = 0; i < n; ++i)
+        new (&arr->slot[i]) std::atomic<node *>(NULL);
+    return arr;
+}
+
+user_table::node *user_table::get_node(shard &sh, size_t need, bool &reused)
+{
+    size_t cap = MIN_NODE_CAP;
+    while (cap < need)
+        cap <<= 1;
+    for (size_t i = 0; i < sh.spare.size(); ++i)
+    {
+        if (sh.spare[i]->cap == cap)
+        {
+            node *n = sh.spare[i];
+            sh.spare[i] = sh.spare.back();
+            sh.spare.pop_back();
+            reused = true;
+            return n;
+        }
+    }
+    node *n = (node *)malloc(sizeof(node) + cap);
+    new (&n->next) std::atomic<node *>(NULL);
+    n->cap = cap;
+    reused = false;
+    return n;
+}
+
+template <typename F>
+bool user_table::lookup(const char *name, F cb) const
+{
+    size_t len = strlen(name);
+    uint64_t h = hash_name(name, len);
+    shard &sh = shard_of(h);
+
+    while (true)
+    {
+        unsigned int begin = sh.seq.load(std::memory_order_acquire);
+        if (begin & 1)
+            continue;
+
+        bucket_array *arr = sh.table.load(std::memory_order_acquire);
+        node *n = arr->slot[h & arr->mask].load(std::memory_order_acquire);
+        bool hit = false;
+        for (int step = 0; n && step < MAX_PROBE; ++step)
+        {
+            if (n->hash == h && n->name_len == len && n->consistent(len, 0) && memcmp(n->data, name, len) == 0)
+            {
+                hit = true;
+                break;
+            }
+            n = n->next.load(std::memory_order_acquire);
+        }
+
+        //删除的节点会被复用改写，必须在校验之前读取内容，校验通过才说明读到的是完整的
+        if (hit)
+            cb(n);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sh.seq.load(std::memory_order_relaxed) != begin)
+            continue;
+        return hit;
+    }
+}
+
+bool user_table::find(const char *name, string &passwd) const
+{
+    return lookup(name, [&passwd](const node *n) {
+        size_t nl = n->name_len, pl = n->passwd_len;
+        if (n->consistent(nl, pl))
+            passwd.assign(n->data + nl + 1, pl);
+    });
+}
+
+bool user_table::verify(const char *name, const char *passwd) const
+{
+    bool same = false;
+    size_t len = strlen(passwd);
+    lookup(name, [&](const node *n) {
+        size_t nl = n->name_len, pl = n->passwd_len;
+        same = n->consistent(nl, pl) && pl == len && memcmp(n->data + nl + 1, passwd, len) == 0;
+    });
+    return same;
+}
+
+bool user_table::insert(const char *name, const char *passwd)
+{
+    size_t name_len = strlen(name);
+    size_t passwd_len = strlen(passwd);
+    if (name_len > MAX_LEN || passwd_len > MAX_LEN)
+        return false;
+    uint64_t h = hash_name(name, name_len);
+    shard &sh = shard_of(h);
+
+    sh.writer.lock();
+    bucket_array *arr = sh.table.load(std::memory_order_relaxed);
+    std::atomic<node *> &head = arr->slot[h & arr->mask];
+    for (node *n = head.load(std::memory_order_relaxed); n; n = n->next.load(std::memory_order_relaxed))
+    {
+        if (n->hash == h && n->name_len == name_len && memcmp(n->data, name, name_len) == 0)
+        {
+            sh.writer.unlock();
+            return false;
+        }
+    }
+
+    bool reused = false;
+    node *n = get_node(sh, name_len + passwd_len + 2, reused);
+    //复用的节点可能还有读者停在上面，改写期间序列号为奇数，这些读者校验失败后重试
+    if (reused)
+    {
+        sh.seq.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    n->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    n->hash = h;
+    n->name_len = name_len;
+    n->passwd_len = passwd_len;
+    memcpy(n->data, name, name_len + 1);
+    memcpy(n->data + name_len + 1, passwd, passwd_len + 1);
+    //头插，release保证读者看到指针时节点内容已写好
+    head.store(n, std::memory_order_release);
+    if (reused)
+        sh.seq.fetch_add(1, std::memory_order_release);
+
+    if (++sh.count > arr->mask + 1)
+        grow(sh);
+    sh.writer.unlock();
+    return true;
+}
+
+bool user_table::erase(const char *name)
+{
+    size_t name_len = strlen(name);
+    uint64_t h = hash_name(name, name_len);
+    shard &sh = shard_of(h);
+
+    sh.writer.lock();
+    bucket_array *arr = sh.table.load(std::memory_order_relaxed);
+    std::atomic<node *> *link = &arr->slot[h & arr->mask];
+    for (node *n = link->load(std::memory_order_relaxed); n; n = n->next.load(std::memory_order_relaxed))
+    {
+        if (n->hash == h && n->name_len == name_len && memcmp(n->data, name, name_len) == 0)
+        {
+            //摘链即可，正停在该节点上的读者沿着n->next仍能继续走下去
+            link->store(n->next.load(std::memory_order_relaxed), std::memory_order_release);
+            sh.spare.push_back(n);
+            --sh.count;
+            sh.writer.unlock();
+            return true;
+        }
+        link = &n->next;
+    }
+    sh.writer.unlock();
+    return false;
+}
+
+size_t user_table::size() const
+{
+    size_t total = 0;
+    for (int i = 0; i < m_shard_num; ++i)
+    {
+        m_shards[i].writer.lock();
+        total += m_shards[i].count;
+        m_shards[i].writer.unlock();
+    }
+    return total;
+}
+
+//桶数翻倍，调用时持有分片写锁
+//重新串接会修改节点的next，用序列号让期间的读者重试
+void user_table::grow(shard &sh)
+{
+    bucket_array *old_arr = sh.table.load(std::memory_order_relaxed);
+    bucket_array *new_arr = new_buckets((old_arr->mask + 1) * 2);
+
+    sh.seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t b = 0; b <= old_arr->mask; ++b)
+    {
+        node *n = old_arr->slot[b].load(std::memory_order_relaxed);
+        while (n)
+        {
+            node *next = n->next.load(std::memory_order_relaxed);
+            std::atomic<node *> &head = new_arr->slot[n->hash & new_arr->mask];
+            n->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            head.store(n, std::memory_order_relaxed);
+            n = next;
+        }
+    }
+    sh.table.store(new_arr, std::memory_order_release);
+    sh.seq.fetch_add(1, std::memory_order_release);
+
+    sh.retired.push_back(old_arr);
+}
@@ -0,0 +1,88 @@
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+/*************************************************************
+*用户名->密码的内存缓存，分片哈希表
+*读：无锁，每个分片用序列锁(seqlock)校验，扩容或节点复用期间读到的结果作废重试，
+*    密码的拷贝和比较都在校验窗口内完成
+*写：每个分片一把互斥锁，不同分片的注册互不影响
+*删除的节点和扩容替换下来的桶数组都不释放，读者无论何时拿到的指针都是有效的；
+*删除的节点按容量挂到分片的空闲链表上，下次插入同档容量的用户时在写锁内复用，复用期间序列号为奇数，
+*停在旧节点上的读者会重试。节点容量按2的幂分档，注册失败回滚(erase)后的内存会被后续注册用掉，不会无限增长
+**************************************************************/
+class user_table
+{
+public:
+    //用户名和密码的最大长度，节点中以uint16_t保存
+    static const size_t MAX_LEN = UINT16_MAX;
+
+    //shard_bits: 分片数为2^shard_bits
+    user_table(int shard_bits = 6);
+    ~user_table();
+
+    //查询用户，找到时将密码拷贝到passwd
+    bool find(const char *name, string &passwd) const;
+    //用户名存在且密码一致
+    bool verify(const char *name, const char *passwd) const;
+    //用户不存在时插入并返回true，已存在或长度超过MAX_LEN返回false
+    bool insert(const char *name, const char *passwd);
+    //删除用户，用于数据库写入失败后回滚
+    bool erase(const char *name);
+    size_t size() const;
+
+private:
+    struct node
+    {
+        std::atomic<node *> next;
+        uint64_t hash;
+        uint16_t name_len;
+        uint16_t passwd_len;
+        uint32_t cap; //data的容量，2的幂
+        char data[1]; //name\0passwd\0
+        const char *passwd() const { return data + name_len + 1; }
+        //读者用：长度与容量不符(读到改写中的节点)时返回false，这次读取随后会因序列号变化作废
+        bool consistent(size_t nl, size_t pl) const { return nl + pl + 2 <= cap; }
+    };
+
+    struct bucket_array
+    {
+        size_t mask;
+        std::atomic<node *> slot[1];
+    };
+
+    //按缓存行对齐，避免不同分片的序列号和锁互相伪共享
+    struct alignas(64) shard
+    {
+        std::atomic<unsigned int> seq; //奇数表示正在扩容
+        std::atomic<bucket_array *> table;
+        size_t count;
+        locker writer;
+        vector<bucket_array *> retired; //扩容替换下来的桶数组，总大小不超过当前桶数组
+        vector<node *> spare;           //删除的节点，等待复用
+    };
+
+    static uint64_t hash_name(const char *name, size_t len);
+    static bucket_array *new_buckets(size_t n);
+    //取一个能放下need字节的节点，优先复用空闲节点，调用时持有分片写锁
+    node *get_node(shard &sh, size_t need, bool &reused);
+    shard &shard_of(uint64_t hash) const { return m_shards[hash >> m_shift]; }
+    //在一个分片内查找，cb在序列锁校验窗口内处理命中节点，校验失败时重试，可能被调用多次
+    template <typename F>
+    bool lookup(const char *name, F cb) const;
+    void grow(shard &sh);
+
+    int m_shard_num;
+    int m_shift;
+    shard *m_shards;
+};
+
+#endif
@@ -0,0 +1,112 @@
+//建连速率：多个线程循环connect/close，统计每秒建成的连接数和connect耗时分布
+//SYN或accept队列溢出时客户端要等1~3秒重传，表现为connect耗时超过1秒
+//用法：./accept_bench [ip] [port] [线程数] [秒数]，默认127.0.0.1 9006 64 5
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+struct bench_arg
+{
+    struct sockaddr_in addr;
+    long long deadline;
+    vector<long long> latency; //每次connect的耗时，微秒
+    long long errors;
+};
+
+static void *connect_loop(void *p)
+{
+    bench_arg *arg = (bench_arg *)p;
+    while (now_us() < arg->deadline)
+    {
+        int fd = socket(PF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            ++arg->errors;
+            continue;
+        }
+        long long start = now_us();
+        if (connect(fd, (struct sockaddr *)&arg->addr, sizeof(arg->addr)) < 0)
+        {
+            ++arg->errors;
+            close(fd);
+            continue;
+        }
+        arg->latency.push_back(now_us() - start);
+
+        //RST关闭，客户端不留TIME_WAIT，长时间运行也不会耗尽本地端口
+        struct linger tmp = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        close(fd);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ip = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 9006;
+    int threads = argc > 3 ? atoi(argv[3]) : 64;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", ip);
+        return 1;
+    }
+
+    vector<pthread_t> tids(threads);
+    vector<bench_arg> args(threads);
+    long long start = now_us();
+    for (int i = 0; i < threads; ++i)
+    {
+        args[i].addr = addr;
+        args[i].deadline = start + seconds * 1000000LL;
+        args[i].errors = 0;
+        pthread_create(&tids[i], NULL, connect_loop, &args[i]);
+    }
+
+    vector<long long> all;
+    long long errors = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        all.insert(all.end(), args[i].latency.begin(), args[i].latency.end());
+        errors += args[i].errors;
+    }
+    double elapsed = (now_us() - start) / 1000000.0;
+    if (all.empty())
+    {
+        fprintf(stderr, "no connection established, %lld errors\n", errors);
+        return 1;
+    }
+
+    sort(all.begin(), all.end());
+    long long slow = all.end() - upper_bound(all.begin(), all.end(), 1000000LL);
+    printf("connections   %zu in %.1fs, %.0f/s, errors %lld\n", all.size(), elapsed, all.size() / elapsed, errors);
+    printf("connect us    p50 %lld  p99 %lld  p99.9 %lld  max %lld\n",
+           all[all.size() / 2], all[all.size() * 99 / 100], all[all.size() * 999 / 1000], all.back());
+    printf("over 1s       %lld (SYN retransmits)\n", slow);
+    return 0;
+}
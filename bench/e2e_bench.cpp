@@ -0,0 +1,568 @@
+//进程内端到端基准：在本进程中启动WebServer(mock存储，不需要数据库)，客户端线程经回环TCP回放固定的请求组合
+//每个连接的请求序列由连接编号决定，总请求数固定，每次运行的请求完全相同
+//统计吞吐、延迟，以及服务端每请求的内存分配次数和系统调用数
+//用法：./e2e_bench [-n 总请求数] [-c 连接数] [-w 组合] [-- 服务器参数]，需在项目根目录运行(页面在root/下)
+//例如 ./e2e_bench -n 50000 -c 16 -w get:60,large:20,login:15,register:5 -- -t 4 --kdf_iter 1000
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <new>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "../webserver.h"
+
+using namespace std;
+
+//------------------------------------------------------------
+//分配和系统调用计数：链接时--wrap=malloc、recv、writev等，服务器代码中的调用先经过这里计数再转给libc，
+//operator new也在这里计数；客户端线程的调用不计入，计数即服务端的开销
+//libc内部的调用(如fopen里的open)不经过--wrap，不计入
+static __thread bool t_client = false;
+static std::atomic<long long> alloc_count(0);
+
+enum SYSCALL_ID
+{
+    S_READ = 0, S_WRITE, S_RECV, S_SEND, S_WRITEV, S_EPOLL_WAIT, S_EPOLL_CTL, S_ACCEPT4,
+    S_CLOSE, S_OPEN, S_STAT, S_MMAP, S_MUNMAP, S_FCNTL, S_SETSOCKOPT, S_SYSCALL_NUM
+};
+static const char *syscall_name[S_SYSCALL_NUM] = {
+    "read", "write", "recv", "send", "writev", "epoll_wait", "epoll_ctl", "accept4",
+    "close", "open", "stat", "mmap", "munmap", "fcntl", "setsockopt"};
+static std::atomic<long long> syscall_count[S_SYSCALL_NUM];
+
+static inline void count_alloc()
+{
+    if (!t_client)
+        alloc_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline void count_syscall(int id)
+{
+    if (!t_client)
+        syscall_count[id].fetch_add(1, std::memory_order_relaxed);
+}
+
+#define WRAP(ret, name, id, params, args)          \
+    extern "C" ret __real_##name params;           \
+    extern "C" ret __wrap_##name params            \
+    {                                              \
+        count_syscall(id);                         \
+        return __real_##name args;                 \
+    }
+
+WRAP(ssize_t, read, S_READ, (int fd, void *buf, size_t n), (fd, buf, n))
+WRAP(ssize_t, write, S_WRITE, (int fd, const void *buf, size_t n), (fd, buf, n))
+WRAP(ssize_t, recv, S_RECV, (int fd, void *buf, size_t n, int flags), (fd, buf, n, flags))
+WRAP(ssize_t, send, S_SEND, (int fd, const void *buf, size_t n, int flags), (fd, buf, n, flags))
+WRAP(ssize_t, writev, S_WRITEV, (int fd, const struct iovec *iov, int cnt), (fd, iov, cnt))
+WRAP(int, epoll_wait, S_EPOLL_WAIT, (int epfd, struct epoll_event *ev, int max, int timeout), (epfd, ev, max, timeout))
+WRAP(int, epoll_ctl, S_EPOLL_CTL, (int epfd, int op, int fd, struct epoll_event *ev), (epfd, op, fd, ev))
+WRAP(int, accept4, S_ACCEPT4, (int fd, struct sockaddr *addr, socklen_t *len, int flags), (fd, addr, len, flags))
+WRAP(int, close, S_CLOSE, (int fd), (fd))
+WRAP(int, stat, S_STAT, (const char *path, struct stat *st), (path, st))
+WRAP(void *, mmap, S_MMAP, (void *addr, size_t len, int prot, int flags, int fd, off_t off), (addr, len, prot, flags, fd, off))
+WRAP(int, munmap, S_MUNMAP, (void *addr, size_t len), (addr, len))
+WRAP(int, setsockopt, S_SETSOCKOPT, (int fd, int level, int opt, const void *val, socklen_t len), (fd, level, opt, val, len))
+
+//open和fcntl是变参函数，第三个参数按需取出
+extern "C" int __real_open(const char *path, int flags, ...);
+extern "C" int __wrap_open(const char *path, int flags, ...)
+{
+    count_syscall(S_OPEN);
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+    return __real_open(path, flags, mode);
+}
+
+extern "C" int __real_fcntl(int fd, int cmd, ...);
+extern "C" int __wrap_fcntl(int fd, int cmd, ...)
+{
+    count_syscall(S_FCNTL);
+    va_list ap;
+    va_start(ap, cmd);
+    long arg = va_arg(ap, long);
+    va_end(ap);
+    return __real_fcntl(fd, cmd, arg);
+}
+
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t n, size_t size);
+extern "C" void *__real_realloc(void *p, size_t size);
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+    count_alloc();
+    return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t n, size_t size)
+{
+    count_alloc();
+    return __real_calloc(n, size);
+}
+
+extern "C" void *__wrap_realloc(void *p, size_t size)
+{
+    count_alloc();
+    return __real_realloc(p, size);
+}
+
+void *operator new(size_t size)
+{
+    count_alloc();
+    void *p = __real_malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+//------------------------------------------------------------
+enum REQ_KIND
+{
+    R_GET = 0, //小页面
+    R_LARGE,   //大图片，走mmap+writev的多次写
+    R_LOGIN,   //登录，查询mock存储并校验口令
+    R_REGISTER,//注册，每次用户名不同
+    R_KIND_NUM
+};
+static const char *kind_name[R_KIND_NUM] = {"get", "large", "login", "register"};
+//期望的响应页面，按页面长度核对登录/注册的结果
+static const char *kind_page[R_KIND_NUM] = {"judge.html", "loginnew.gif", "welcome.html", "log.html"};
+static long long kind_len[R_KIND_NUM];
+
+static const char *BENCH_USER = "bench";
+static const char *BENCH_PASSWD = "bench12";
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+struct client
+{
+    int id;
+    int port;
+    long long warmup;          //测量前先发的请求数
+    vector<char> seq;          //请求种类序列，前warmup个为预热
+    vector<long long> lat_us;  //测量区间内每个请求的延迟
+    long long errors;
+    long long reconnects;
+    pthread_barrier_t *barrier;
+
+    int fd;
+    char buf[65536];
+};
+
+static int connect_server(int port)
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    return fd;
+}
+
+//生成第n个请求，不分配内存
+static int build_request(char *out, int cap, int kind, int id, long long n)
+{
+    char body[128];
+    int body_len;
+    switch (kind)
+    {
+    case R_GET:
+        return snprintf(out, cap, "GET /judge.html HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n");
+    case R_LARGE:
+        return snprintf(out, cap, "GET /loginnew.gif HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n");
+    case R_LOGIN:
+        body_len = snprintf(body, sizeof(body), "user=%s&password=%s", BENCH_USER, BENCH_PASSWD);
+        return snprintf(out, cap, "POST /2CGISQL.cgi HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n"
+                                  "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n%s",
+                        body_len, body);
+    default:
+        body_len = snprintf(body, sizeof(body), "user=u%d_%lld&password=%s", id, n, BENCH_PASSWD);
+        return snprintf(out, cap, "POST /3CGISQL.cgi HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n"
+                                  "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n%s",
+                        body_len, body);
+    }
+}
+
+//读完一个响应，返回状态码，出错返回-1；body_len为消息体长度，closed表示服务器要求关闭连接
+static int read_response(client *c, long long &body_len, bool &closed)
+{
+    int have = 0;
+    char *end = NULL;
+    while (!end)
+    {
+        if (have == (int)sizeof(c->buf) - 1)
+            return -1;
+        int n = read(c->fd, c->buf + have, sizeof(c->buf) - 1 - have);
+        if (n <= 0)
+            return -1;
+        have += n;
+        c->buf[have] = '\0';
+        end = strstr(c->buf, "\r\n\r\n");
+    }
+    *end = '\0';
+    int status = 0;
+    if (sscanf(c->buf, "HTTP/1.1 %d", &status) != 1)
+        return -1;
+    //只发送不带Accept-Encoding的请求，响应都带Content-Length
+    const char *cl = strcasestr(c->buf, "\r\nContent-Length:");
+    if (!cl)
+        return -1;
+    body_len = atoll(cl + 17);
+    closed = strcasestr(c->buf, "\r\nConnection: close") != NULL;
+
+    long long remain = body_len - (have - (end + 4 - c->buf));
+    while (remain > 0)
+    {
+        int n = read(c->fd, c->buf, remain < (long long)sizeof(c->buf) ? remain : sizeof(c->buf));
+        if (n <= 0)
+            return -1;
+        remain -= n;
+    }
+    return status;
+}
+
+//发送一个请求并读完响应，结果与期望不符计为错误
+static bool do_request(client *c, long long n)
+{
+    if (c->fd < 0)
+    {
+        c->fd = connect_server(c->port);
+        ++c->reconnects;
+        if (c->fd < 0)
+            return false;
+    }
+    int kind = c->seq[n];
+    char req[512];
+    int len = build_request(req, sizeof(req), kind, c->id, n);
+    long long body_len = 0;
+    bool closed = false;
+    int status = -1;
+    if (write(c->fd, req, len) == len)
+        status = read_response(c, body_len, closed);
+    if (status < 0 || closed)
+    {
+        close(c->fd);
+        c->fd = -1;
+    }
+    return 200 == status && body_len == kind_len[kind];
+}
+
+static void *client_loop(void *p)
+{
+    client *c = (client *)p;
+    t_client = true;
+    c->fd = -1;
+    c->reconnects = -1;
+    for (long long n = 0; n < c->warmup; ++n)
+        do_request(c, n);
+
+    pthread_barrier_wait(c->barrier);
+    long long total = c->seq.size();
+    for (long long n = c->warmup; n < total; ++n)
+    {
+        long long start = now_us();
+        if (!do_request(c, n))
+            ++c->errors;
+        c->lat_us[n - c->warmup] = now_us() - start;
+    }
+    if (c->fd >= 0)
+        close(c->fd);
+    return NULL;
+}
+
+static void *server_loop(void *p)
+{
+    //主线程屏蔽了定时信号，只由事件循环所在线程处理
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    ((WebServer *)p)->eventLoop();
+    return NULL;
+}
+
+//解析形如get:70,large:10,login:15,register:5的组合
+static bool parse_mix(const char *spec, int weight[R_KIND_NUM])
+{
+    memset(weight, 0, sizeof(int) * R_KIND_NUM);
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", spec);
+    for (char *item = strtok(copy, ","); item; item = strtok(NULL, ","))
+    {
+        char *colon = strchr(item, ':');
+        if (!colon)
+            return false;
+        *colon = '\0';
+        int k = 0;
+        while (k < R_KIND_NUM && strcmp(item, kind_name[k]) != 0)
+            ++k;
+        if (k == R_KIND_NUM)
+            return false;
+        weight[k] = atoi(colon + 1);
+    }
+    return true;
+}
+
+static long long percentile(vector<long long> &v, double q)
+{
+    if (v.empty())
+        return 0;
+    size_t idx = (size_t)(q * (v.size() - 1));
+    return v[idx];
+}
+
+int main(int argc, char *argv[])
+{
+    long long total = 20000;
+    int conns = 8;
+    const char *mix = "get:70,large:10,login:15,register:5";
+    //服务器默认参数：mock存储、关闭日志、随机端口，口令哈希迭代降为1000以免登录的哈希计算淹没其余开销，可在--之后覆盖
+    vector<char *> server_argv;
+    server_argv.push_back(argv[0]);
+    const char *defaults[] = {"-p", "0", "--store", "mock", "-c", "1", "--kdf_iter", "1000"};
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i)
+        server_argv.push_back((char *)defaults[i]);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            for (++i; i < argc; ++i)
+                server_argv.push_back(argv[i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            total = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            conns = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            mix = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: %s [-n requests] [-c connections] [-w get:70,large:10,login:15,register:5] [-- server options]\n", argv[0]);
+            return 1;
+        }
+    }
+    int weight[R_KIND_NUM];
+    int weight_sum = 0;
+    if (!parse_mix(mix, weight))
+    {
+        fprintf(stderr, "bad mix: %s\n", mix);
+        return 1;
+    }
+    for (int k = 0; k < R_KIND_NUM; ++k)
+        weight_sum += weight[k];
+    if (conns < 1 || total < conns || weight_sum <= 0)
+    {
+        fprintf(stderr, "need -c >= 1, -n >= -c and a non-empty mix\n");
+        return 1;
+    }
+
+    //期望的响应长度
+    for (int k = 0; k < R_KIND_NUM; ++k)
+    {
+        char path[256];
+        struct stat st;
+        snprintf(path, sizeof(path), "root/%s", kind_page[k]);
+        if (stat(path, &st) < 0)
+        {
+            fprintf(stderr, "%s not found, run from the project root\n", path);
+            return 1;
+        }
+        kind_len[k] = st.st_size;
+    }
+
+    //之后创建的线程(工作线程、日志线程、客户端)都屏蔽定时信号
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    Config config;
+    config.parse_arg(server_argv.size(), server_argv.data());
+    WebServer *server = new WebServer;
+    server->init(config, "root", "root", "yourdb");
+    server->log_write();
+    server->sql_pool();
+    server->thread_pool();
+    server->rate_limit();
+    server->trig_mode();
+    server->eventListen();
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    getsockname(server->m_listenfd, (struct sockaddr *)&addr, &addr_len);
+    int port = ntohs(addr.sin_port);
+
+    pthread_t server_tid;
+    pthread_create(&server_tid, NULL, server_loop, server);
+
+    //登录用的账号经注册请求写入
+    {
+        client reg;
+        reg.id = -1;
+        reg.port = port;
+        reg.fd = -1;
+        char req[512];
+        char body[128];
+        int body_len = snprintf(body, sizeof(body), "user=%s&password=%s", BENCH_USER, BENCH_PASSWD);
+        int len = snprintf(req, sizeof(req), "POST /3CGISQL.cgi HTTP/1.1\r\nHost: bench\r\n"
+                                             "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n%s",
+                           body_len, body);
+        reg.fd = connect_server(port);
+        long long resp_len = 0;
+        bool closed = false;
+        if (reg.fd < 0 || write(reg.fd, req, len) != len || read_response(&reg, resp_len, closed) != 200 ||
+            resp_len != kind_len[R_REGISTER])
+        {
+            fprintf(stderr, "cannot register the bench user\n");
+            return 1;
+        }
+        close(reg.fd);
+    }
+
+    //按连接编号生成确定的请求序列
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, conns + 1);
+    vector<client *> clients(conns);
+    for (int i = 0; i < conns; ++i)
+    {
+        client *c = new client;
+        c->id = i;
+        c->port = port;
+        c->errors = 0;
+        c->barrier = &barrier;
+        long long n = total / conns + (i < total % conns ? 1 : 0);
+        c->warmup = n / 10 < 100 ? n / 10 : 100;
+        unsigned int seed = i + 1;
+        c->seq.resize(c->warmup + n);
+        for (size_t j = 0; j < c->seq.size(); ++j)
+        {
+            int r = rand_r(&seed) % weight_sum;
+            int k = 0;
+            while (r >= weight[k])
+                r -= weight[k++];
+            c->seq[j] = k;
+        }
+        c->lat_us.assign(n, 0);
+        clients[i] = c;
+    }
+
+    vector<pthread_t> tids(conns);
+    for (int i = 0; i < conns; ++i)
+        pthread_create(&tids[i], NULL, client_loop, clients[i]);
+
+    //预热结束后开始计量
+    pthread_barrier_wait(&barrier);
+    long long syscalls0[S_SYSCALL_NUM];
+    for (int k = 0; k < S_SYSCALL_NUM; ++k)
+        syscalls0[k] = syscall_count[k].load();
+    long long allocs0 = alloc_count.load();
+    long long start = now_us();
+    for (int i = 0; i < conns; ++i)
+        pthread_join(tids[i], NULL);
+    long long elapsed = now_us() - start;
+    long long allocs = alloc_count.load() - allocs0;
+    long long syscalls[S_SYSCALL_NUM], syscall_total = 0;
+    for (int k = 0; k < S_SYSCALL_NUM; ++k)
+    {
+        syscalls[k] = syscall_count[k].load() - syscalls0[k];
+        syscall_total += syscalls[k];
+    }
+
+    char sig = SIGTERM;
+    send(server->m_pipefd[1], &sig, 1, MSG_NOSIGNAL);
+    pthread_join(server_tid, NULL);
+
+    long long errors = 0, reconnects = 0;
+    vector<long long> all, per_kind[R_KIND_NUM];
+    long long kind_count[R_KIND_NUM] = {0};
+    for (int i = 0; i < conns; ++i)
+    {
+        client *c = clients[i];
+        errors += c->errors;
+        reconnects += c->reconnects;
+        for (size_t j = 0; j < c->lat_us.size(); ++j)
+        {
+            int k = c->seq[c->warmup + j];
+            all.push_back(c->lat_us[j]);
+            per_kind[k].push_back(c->lat_us[j]);
+            ++kind_count[k];
+        }
+    }
+    long long measured = all.size();
+    sort(all.begin(), all.end());
+
+    printf("mix             %s, %d connections, server:", mix, conns);
+    for (size_t i = 1; i < server_argv.size(); ++i)
+        printf(" %s", server_argv[i]);
+    printf("\n");
+    printf("requests        %lld (errors %lld, reconnects %lld)\n", measured, errors, reconnects);
+    printf("elapsed         %.3f s\n", elapsed / 1e6);
+    printf("throughput      %.0f req/s\n", measured * 1e6 / elapsed);
+    printf("latency us      p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+           percentile(all, 0.5), percentile(all, 0.9), percentile(all, 0.99), all.back());
+    for (int k = 0; k < R_KIND_NUM; ++k)
+    {
+        if (per_kind[k].empty())
+            continue;
+        sort(per_kind[k].begin(), per_kind[k].end());
+        printf("  %-13s %lld requests  p50 %lld  p99 %lld\n", kind_name[k], kind_count[k],
+               percentile(per_kind[k], 0.5), percentile(per_kind[k], 0.99));
+    }
+    printf("allocs/request  %.2f\n", (double)allocs / measured);
+    printf("syscalls/request %.2f\n", (double)syscall_total / measured);
+    for (int k = 0; k < S_SYSCALL_NUM; ++k)
+    {
+        if (syscalls[k])
+            printf("  %-13s %.2f\n", syscall_name[k], (double)syscalls[k] / measured);
+    }
+    return errors ? 2 : 0;
+}
@@ -0,0 +1,94 @@
+//口令校验吞吐：各PBKDF2迭代次数下每核每秒可完成的登录校验数
+//用法：./kdf_bench [线程数] [迭代次数...]，默认线程数为CPU核数，迭代次数为0 1000 10000 100000
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+#include <atomic>
+#include "../CGImysql/password.h"
+
+//每个设置的测量时长，微秒
+static const long long RUN_US = 1000000;
+
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+struct bench_arg
+{
+    string stored;
+    long long deadline;
+    long long count;
+};
+
+static void *verify_loop(void *p)
+{
+    bench_arg *arg = (bench_arg *)p;
+    long long n = 0;
+    while (now_us() < arg->deadline)
+    {
+        //一正一误，与真实登录的分支一致
+        bool expect = !(n & 1);
+        if (password_verify(expect ? "correct-password" : "wrong-password", arg->stored) != expect)
+        {
+            fprintf(stderr, "verify result mismatch\n");
+            exit(1);
+        }
+        ++n;
+    }
+    arg->count = n;
+    return NULL;
+}
+
+//threads个线程同时校验，返回总的每秒校验次数
+static double run(const string &stored, int threads)
+{
+    vector<pthread_t> tids(threads);
+    vector<bench_arg> args(threads);
+    long long start = now_us();
+    for (int i = 0; i < threads; ++i)
+    {
+        args[i].stored = stored;
+        args[i].deadline = start + RUN_US;
+        pthread_create(&tids[i], NULL, verify_loop, &args[i]);
+    }
+    long long total = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        total += args[i].count;
+    }
+    return total * 1000000.0 / (now_us() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+        threads = atoi(argv[1]);
+    vector<int> iters;
+    for (int i = 2; i < argc; ++i)
+        iters.push_back(atoi(argv[i]));
+    if (iters.empty())
+    {
+        iters.push_back(0);
+        iters.push_back(1000);
+        iters.push_back(10000);
+        iters.push_back(100000);
+    }
+
+    printf("%-10s %14s %14s %14s %12s\n", "iter", "1 thread/s", "threads", "total/s", "per core/s");
+    for (size_t i = 0; i < iters.size(); ++i)
+    {
+        string stored = password_hash("correct-password", iters[i]);
+        double single = run(stored, 1);
+        double total = run(stored, threads);
+        printf("%-10d %14.0f %14d %14.0f %12.0f\n", iters[i], single, threads, total, total / threads);
+    }
+    return 0;
+}
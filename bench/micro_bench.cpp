@@ -0,0 +1,490 @@
+//核心组件的微基准：定时器链表、阻塞队列、线程池分发、日志、请求解析、数据库连接池
+//每项单独运行，可并发的组件按1、2、4...到最大线程数依次测量
+//用法：./micro_bench [名称前缀] [最大线程数]，默认全部运行，最大线程数为CPU核数
+//例如 ./micro_bench http 1    ./micro_bench timer    ./micro_bench log_sync 8
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+#include <atomic>
+
+#include "../timer/lst_timer.h"
+#include "../log/block_queue.h"
+#include "../log/log.h"
+#include "../threadpool/threadpool.h"
+#include "../http/http_conn.h"
+#include "../CGImysql/mock_store.h"
+#ifndef NO_MYSQL
+#include "../CGImysql/sql_connection_pool.h"
+#endif
+
+using namespace std;
+
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static const char *g_filter = "";
+static int g_max_threads = 1;
+//结果输出；http_conn会把不认识的头部printf到stdout，测请求解析时stdout指向/dev/null
+static FILE *g_out = stdout;
+
+//名称前缀匹配，过滤串比分组名长时(如http_parse_line)也选中该分组
+static bool selected(const char *name)
+{
+    size_t len = strlen(g_filter) < strlen(name) ? strlen(g_filter) : strlen(name);
+    return strncmp(name, g_filter, len) == 0;
+}
+
+static void report(const char *name, const char *variant, int threads, long long ops, long long us)
+{
+    if (us <= 0)
+        us = 1;
+    fprintf(g_out, "%-18s %-16s threads %3d  %12.0f ops/s  %10.1f ns/op\n",
+           name, variant, threads, ops * 1000000.0 / us, us * 1000.0 / ops);
+    fflush(g_out);
+}
+
+//1, 2, 4 ... 直到最大线程数(不是2的幂时最后补上)
+static vector<int> thread_counts()
+{
+    vector<int> counts;
+    for (int n = 1; n < g_max_threads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(g_max_threads);
+    return counts;
+}
+
+//n个线程同时开始各自执行fn，返回从开始到全部结束的微秒数
+struct thread_job
+{
+    void (*fn)(int tid, void *ctx);
+    void *ctx;
+    int tid;
+    pthread_barrier_t *barrier;
+};
+
+static void *thread_entry(void *p)
+{
+    thread_job *job = (thread_job *)p;
+    pthread_barrier_wait(job->barrier);
+    job->fn(job->tid, job->ctx);
+    return NULL;
+}
+
+static long long run_threads(int n, void (*fn)(int, void *), void *ctx)
+{
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, n + 1);
+    vector<pthread_t> tids(n);
+    vector<thread_job> jobs(n);
+    for (int i = 0; i < n; ++i)
+    {
+        jobs[i].fn = fn;
+        jobs[i].ctx = ctx;
+        jobs[i].tid = i;
+        jobs[i].barrier = &barrier;
+        pthread_create(&tids[i], NULL, thread_entry, &jobs[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    long long start = now_us();
+    for (int i = 0; i < n; ++i)
+        pthread_join(tids[i], NULL);
+    long long elapsed = now_us() - start;
+    pthread_barrier_destroy(&barrier);
+    return elapsed;
+}
+
+//------------------------------------------------------------
+//定时器链表：只在主线程使用，单线程测量
+//新连接和续期的超时时间都是当前时间加固定时长，总是落在链表尾部附近，而插入从头部开始找位置
+static void bench_timer()
+{
+    static const int live_counts[] = {100, 1000, 10000};
+    for (size_t k = 0; k < sizeof(live_counts) / sizeof(live_counts[0]); ++k)
+    {
+        int live = live_counts[k];
+        sort_timer_lst lst;
+        vector<util_timer *> timers(live);
+        vector<client_data> users(live);
+        unsigned int seed = 1;
+        time_t base = 1000000;
+        for (int i = 0; i < live; ++i)
+        {
+            timers[i] = new util_timer;
+            timers[i]->user_data = &users[i];
+            timers[i]->cb_func = NULL;
+            timers[i]->expire = base + rand_r(&seed) % 15;
+            lst.add_timer(timers[i]);
+        }
+
+        char variant[32];
+        snprintf(variant, sizeof(variant), "%d live", live);
+        long long iters = 2000000 / live + 1000;
+
+        //续期：超时时间后移，adjust_timer从当前位置往后找
+        long long start = now_us();
+        for (long long n = 0; n < iters; ++n)
+        {
+            util_timer *t = timers[rand_r(&seed) % live];
+            t->expire = base + 15 + n / live;
+            lst.adjust_timer(t);
+        }
+        report("timer_adjust", variant, 1, iters, now_us() - start);
+
+        //连接关闭再建立：删除一个，插入一个超时时间最晚的
+        start = now_us();
+        for (long long n = 0; n < iters; ++n)
+        {
+            int idx = rand_r(&seed) % live;
+            lst.del_timer(timers[idx]);
+            timers[idx] = new util_timer;
+            timers[idx]->user_data = &users[idx];
+            timers[idx]->cb_func = NULL;
+            timers[idx]->expire = base + 30 + n / live;
+            lst.add_timer(timers[idx]);
+        }
+        report("timer_add_del", variant, 1, iters, now_us() - start);
+
+        //阶段切换时超时提前：摘下后重新插入
+        start = now_us();
+        for (long long n = 0; n < iters; ++n)
+        {
+            util_timer *t = timers[rand_r(&seed) % live];
+            t->expire = base + rand_r(&seed) % 30;
+            lst.move_timer(t);
+        }
+        report("timer_move", variant, 1, iters, now_us() - start);
+    }
+}
+
+//------------------------------------------------------------
+//阻塞队列：n个生产者、n个消费者，队列长度与异步日志相同
+struct queue_ctx
+{
+    block_queue<string> *queue;
+    int producers;
+    long long per_thread;
+};
+
+static void queue_worker(int tid, void *p)
+{
+    queue_ctx *ctx = (queue_ctx *)p;
+    if (tid < ctx->producers)
+    {
+        string line(120, 'x');
+        for (long long i = 0; i < ctx->per_thread; ++i)
+        {
+            while (!ctx->queue->push(line))
+                sched_yield();
+        }
+    }
+    else
+    {
+        string line;
+        for (long long i = 0; i < ctx->per_thread; ++i)
+            ctx->queue->pop(line);
+    }
+}
+
+static void bench_block_queue()
+{
+    vector<int> counts = thread_counts();
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        block_queue<string> queue(800);
+        queue_ctx ctx = {&queue, counts[i], 400000 / counts[i]};
+        long long us = run_threads(counts[i] * 2, queue_worker, &ctx);
+        report("block_queue", "push+pop", counts[i], ctx.per_thread * counts[i], us);
+    }
+}
+
+//------------------------------------------------------------
+//线程池分发：主线程一个生产者，工作线程数变化，请求本身不做事，测的是入队、唤醒和出队
+struct dummy_request
+{
+    int m_state;
+    std::atomic<int> improv;
+    int timer_flag;
+    static std::atomic<long long> done;
+
+    unsigned int get_conn_id() { return 0; }
+    bool read_once() { return true; }
+    bool write() { return true; }
+    bool pipelined() const { return false; }
+    void process() { done.fetch_add(1, std::memory_order_relaxed); }
+    void shed() { done.fetch_add(1, std::memory_order_relaxed); }
+};
+std::atomic<long long> dummy_request::done(0);
+
+static void bench_threadpool()
+{
+    vector<int> counts = thread_counts();
+    static dummy_request request;
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        //工作线程是分离的，不会退出；每组用新的线程池，旧的阻塞在信号量上不占CPU
+        threadpool<dummy_request> *pool = new threadpool<dummy_request>(0, counts[i], 10000);
+        long long total = 500000;
+        dummy_request::done = 0;
+        long long start = now_us();
+        for (long long n = 0; n < total; ++n)
+        {
+            while (!pool->append_p(&request))
+                sched_yield();
+        }
+        while (dummy_request::done.load() < total)
+            sched_yield();
+        report("threadpool", "append_p", counts[i], total, now_us() - start);
+    }
+}
+
+//------------------------------------------------------------
+//日志：单例只能初始化一次，同步和异步分两次运行
+static void log_worker(int tid, void *p)
+{
+    long long n = *(long long *)p;
+    for (long long i = 0; i < n; ++i)
+        Log::get_instance()->write_log(1, "deal with the client(%s) fd %d request %lld", "127.0.0.1", tid, i);
+}
+
+static bool log_ready = false;
+
+static void bench_log(bool async)
+{
+    const char *name = async ? "log_async" : "log_sync";
+    if (log_ready)
+    {
+        fprintf(g_out, "%-18s skipped: Log is a singleton, run ./micro_bench %s separately\n", name, name);
+        return;
+    }
+    char dir[] = "/tmp/micro_bench.XXXXXX";
+    if (!mkdtemp(dir))
+        return;
+    string path = string(dir) + "/ServerLog";
+    //与服务器的参数一致：-l 1时阻塞队列长度800
+    if (!Log::get_instance()->init(path.c_str(), 0, 2000, 800000, async ? 800 : 0))
+    {
+        fprintf(stderr, "log init failed\n");
+        return;
+    }
+    log_ready = true;
+
+    vector<int> counts = thread_counts();
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        long long per_thread = 200000 / counts[i];
+        long long us = run_threads(counts[i], log_worker, &per_thread);
+        Log::get_instance()->flush();
+        report(name, "write_log", counts[i], per_thread * counts[i], us);
+    }
+    fprintf(g_out, "%-18s log files in %s\n", name, dir);
+}
+
+//------------------------------------------------------------
+//请求解析：每个线程一个http_conn，输入为抓取的真实请求
+static const char *fixtures[][2] = {
+    {"browser_get",
+     "GET / HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "Connection: keep-alive\r\n"
+     "Cache-Control: max-age=0\r\n"
+     "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+     "sec-ch-ua-mobile: ?0\r\n"
+     "sec-ch-ua-platform: \"Linux\"\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+     "Sec-Fetch-Site: none\r\n"
+     "Sec-Fetch-Mode: navigate\r\n"
+     "Sec-Fetch-User: ?1\r\n"
+     "Sec-Fetch-Dest: document\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+     "\r\n"},
+    {"curl_get",
+     "GET /judge.html HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "User-Agent: curl/8.5.0\r\n"
+     "Accept: */*\r\n"
+     "\r\n"},
+    {"form_login",
+     "POST /2CGISQL.cgi HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "Connection: keep-alive\r\n"
+     "Content-Length: 27\r\n"
+     "Origin: http://127.0.0.1:9006\r\n"
+     "Content-Type: application/x-www-form-urlencoded\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+     "Referer: http://127.0.0.1:9006/1\r\n"
+     "Accept-Encoding: gzip, deflate, br\r\n"
+     "Accept-Language: zh-CN,zh;q=0.9\r\n"
+     "\r\n"
+     "user=bench&password=bench12"}};
+static const int FIXTURE_NUM = sizeof(fixtures) / sizeof(fixtures[0]);
+
+static char doc_root[256];
+
+//http_conn在头文件中声明了本结构为友元，可以直接调用私有的解析函数
+struct http_conn_bench
+{
+    static void load(http_conn &conn, const char *request)
+    {
+        int len = strlen(request);
+        memcpy(conn.m_read_buf, request, len);
+        conn.m_read_idx = len;
+    }
+
+    //只切分行：从状态机扫描\r\n
+    static void parse_line(http_conn &conn, const char *request, long long iters)
+    {
+        for (long long i = 0; i < iters; ++i)
+        {
+            load(conn, request);
+            conn.m_checked_idx = 0;
+            conn.m_start_line = 0;
+            while (conn.parse_line() == http_conn::LINE_OK)
+                conn.m_start_line = conn.m_checked_idx;
+        }
+    }
+
+    //完整的一次请求处理：解析请求行、头部、消息体，do_request(stat/mmap，登录查询替身存储)，再复位连接
+    static void process_read(http_conn &conn, const char *request, long long iters)
+    {
+        for (long long i = 0; i < iters; ++i)
+        {
+            load(conn, request);
+            conn.process_read();
+            conn.unmap();
+            conn.init();
+        }
+    }
+};
+
+struct http_ctx
+{
+    const char *request;
+    long long per_thread;
+    bool full;
+};
+
+static void http_worker(int tid, void *p)
+{
+    http_ctx *ctx = (http_ctx *)p;
+    http_conn *conn = new http_conn;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    //不收发数据，fd只是占位；关闭日志，日志开销由log_*单独测量
+    conn->init(-1, addr, doc_root, 0, 1, "", "", "");
+    if (ctx->full)
+        http_conn_bench::process_read(*conn, ctx->request, ctx->per_thread);
+    else
+        http_conn_bench::parse_line(*conn, ctx->request, ctx->per_thread);
+    delete conn;
+}
+
+static void bench_http()
+{
+    if (!getcwd(doc_root, sizeof(doc_root) - 8))
+        return;
+    strcat(doc_root, "/root");
+    mock_store *store = new mock_store(0);
+    store->add_user("bench", password_hash("bench12", 0).c_str(), NULL, NULL);
+    http_conn::m_store = store;
+    fflush(stdout);
+    freopen("/dev/null", "w", stdout);
+
+    vector<int> counts = thread_counts();
+    for (int full = 0; full <= 1; ++full)
+    {
+        for (int f = 0; f < FIXTURE_NUM; ++f)
+        {
+            for (size_t i = 0; i < counts.size(); ++i)
+            {
+                http_ctx ctx = {fixtures[f][1], 200000 / counts[i], full == 1};
+                long long us = run_threads(counts[i], http_worker, &ctx);
+                report(full ? "http_process_read" : "http_parse_line", fixtures[f][0], counts[i],
+                       ctx.per_thread * counts[i], us);
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------
+//数据库连接池：n个线程循环获取/归还连接，连接数上限固定为8，线程多于连接时体现等待开销
+#ifndef NO_MYSQL
+static void pool_worker(int tid, void *p)
+{
+    long long n = *(long long *)p;
+    connection_pool *pool = connection_pool::GetInstance();
+    for (long long i = 0; i < n; ++i)
+    {
+        MYSQL *conn = pool->GetConnection();
+        if (conn)
+            pool->ReleaseConnection(conn);
+    }
+}
+#endif
+
+static void bench_conn_pool()
+{
+#ifndef NO_MYSQL
+    //与main.cpp相同的默认账号，可用环境变量覆盖
+    const char *user = getenv("MYSQL_USER") ? getenv("MYSQL_USER") : "root";
+    const char *passwd = getenv("MYSQL_PASSWORD") ? getenv("MYSQL_PASSWORD") : "root";
+    const char *db = getenv("MYSQL_DB") ? getenv("MYSQL_DB") : "yourdb";
+    connection_pool *pool = connection_pool::GetInstance();
+    pool->init("localhost", user, passwd, db, 3306, 8, 8, 1);
+    MYSQL *probe = pool->GetConnection();
+    if (!probe)
+    {
+        fprintf(g_out, "%-18s skipped: cannot connect to MySQL\n", "conn_pool");
+        return;
+    }
+    pool->ReleaseConnection(probe);
+
+    vector<int> counts = thread_counts();
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        long long per_thread = 400000 / counts[i];
+        long long us = run_threads(counts[i], pool_worker, &per_thread);
+        report("conn_pool", "acquire+release", counts[i], per_thread * counts[i], us);
+    }
+#else
+    fprintf(g_out, "%-18s skipped: built with MYSQL=0\n", "conn_pool");
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        g_filter = argv[1];
+    g_max_threads = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_max_threads < 1)
+        g_max_threads = 1;
+    g_out = fdopen(dup(STDOUT_FILENO), "w");
+
+    if (selected("timer"))
+        bench_timer();
+    if (selected("block_queue"))
+        bench_block_queue();
+    if (selected("threadpool"))
+        bench_threadpool();
+    if (selected("log_async"))
+        bench_log(true);
+    if (selected("log_sync"))
+        bench_log(false);
+    if (selected("http"))
+        bench_http();
+    if (selected("conn_pool"))
+        bench_conn_pool();
+    return 0;
+}
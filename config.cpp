@@ -1,5 +1,47 @@
 #include "config.h"
 
+//长选项编号，从256开始以免与短选项冲突
+enum
+{
+    OPT_ACCESS_SAMPLE = 256,
+    OPT_LOG_COMPRESS,
+    OPT_LOG_MAX_FILES,
+    OPT_LOG_MAX_SIZE,
+    OPT_ASYNC_SQL,
+    OPT_STORE,
+    OPT_STORE_FILE,
+    OPT_STORE_LATENCY,
+    OPT_SQL_BATCH,
+    OPT_SQL_BATCH_DELAY,
+    OPT_SQL_MIN,
+    OPT_SQL_IDLE,
+    OPT_SQL_TIMEOUT,
+    OPT_KDF_ITER,
+    OPT_KDF_THREADS,
+    OPT_KDF_QUEUE,
+    OPT_MAX_BODY,
+    OPT_UPLOAD_DIR,
+    OPT_HEADER_TIMEOUT,
+    OPT_BODY_TIMEOUT,
+    OPT_WRITE_TIMEOUT,
+    OPT_KEEPALIVE_TIMEOUT,
+    OPT_MAX_REQUESTS,
+    OPT_BACKLOG,
+    OPT_ACCEPT_BATCH,
+    OPT_QUEUE_MAX,
+    OPT_CODEL_TARGET,
+    OPT_CODEL_INTERVAL,
+    OPT_IP_RATE,
+    OPT_IP_BURST,
+    OPT_IP_CONN_RATE,
+    OPT_IP_CONN_BURST,
+    OPT_IP_MAX_CONNS,
+    OPT_IP_TABLE,
+    OPT_ADMIN_PORT,
+    OPT_DRAIN_TIMEOUT,
+    OPT_REUSE_PORT
+};
+
 Config::Config(){
     //端口号,默认9006
     PORT = 9006;
@@ -19,8 +61,13 @@ Config::Config(){
     //优雅关闭链接，默认不使用
     OPT_LINGER = 0;
 
-    //数据库连接池数量,默认8
+    //数据库连接池数量,默认最多8条，至少保持2条，空闲60秒回收
     sql_num = 8;
+    sql_min = 2;
+    sql_idle = 60;
+
+    //获取数据库连接最多等待1秒
+    sql_timeout = 1000;
 
     //线程池内的线程数量,默认8
     thread_num = 8;
@@ -30,12 +77,112 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //访问日志采样,默认每个请求都记录
+    access_sample = 1;
+
+    //旧日志默认不压缩、不清理
+    log_compress = 0;
+    log_max_files = 0;
+    log_max_size = 0;
+
+    //默认不使用异步数据库客户端
+    async_sql_num = 0;
+
+    //默认不合并注册写库，开启后最多攒5ms
+    sql_batch = 0;
+    sql_batch_delay = 5;
+
+    //口令默认PBKDF2加盐哈希，2个计算线程
+    kdf_iter = 10000;
+    kdf_threads = 2;
+    kdf_queue = 1000;
+
+    //用户存储默认使用MySQL
+    store = "mysql";
+    store_file = "./users.db";
+    store_latency = 0;
+
+    //消息体默认最大64MB，上传文件默认不保存
+    max_body = 64;
+    upload_dir = "";
+
+    //各阶段超时默认与原来统一的15秒一致，单连接请求数默认不限
+    header_timeout = 15;
+    body_timeout = 15;
+    write_timeout = 15;
+    keepalive_timeout = 15;
+    max_requests = 0;
+
+    //backlog默认取somaxconn，每轮最多accept 64个连接
+    backlog = 0;
+    accept_batch = 64;
+
+    //工作队列最多10000个请求，200ms内排队时间都超过20ms即为过载，丢弃排队超过40ms的请求
+    queue_max = 10000;
+    codel_target = 20;
+    codel_interval = 200;
+
+    //默认不按IP限流，开启后最多跟踪约100万个IP(32MB)
+    ip_rate = 0;
+    ip_burst = 0;
+    ip_conn_rate = 0;
+    ip_conn_burst = 0;
+    ip_max_conns = 0;
+    ip_table = 1 << 20;
+
+    //默认不开管理端口
+    admin_port = 0;
+
+    //默认收到SIGTERM立即退出，不排空连接；不开SO_REUSEPORT
+    drain_timeout = 0;
+    reuse_port = 0;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
     const char *str = "p:l:m:o:s:t:c:a:";
-    while ((opt = getopt(argc, argv, str)) != -1)
+    //没有短选项的参数只提供长选项，如 --access_sample=10
+    static struct option long_opts[] = {
+        {"access_sample", required_argument, NULL, OPT_ACCESS_SAMPLE},
+        {"log_compress", required_argument, NULL, OPT_LOG_COMPRESS},
+        {"log_max_files", required_argument, NULL, OPT_LOG_MAX_FILES},
+        {"log_max_size", required_argument, NULL, OPT_LOG_MAX_SIZE},
+        {"async_sql", required_argument, NULL, OPT_ASYNC_SQL},
+        {"store", required_argument, NULL, OPT_STORE},
+        {"store_file", required_argument, NULL, OPT_STORE_FILE},
+        {"store_latency", required_argument, NULL, OPT_STORE_LATENCY},
+        {"sql_batch", required_argument, NULL, OPT_SQL_BATCH},
+        {"sql_batch_delay", required_argument, NULL, OPT_SQL_BATCH_DELAY},
+        {"sql_min", required_argument, NULL, OPT_SQL_MIN},
+        {"sql_idle", required_argument, NULL, OPT_SQL_IDLE},
+        {"sql_timeout", required_argument, NULL, OPT_SQL_TIMEOUT},
+        {"kdf_iter", required_argument, NULL, OPT_KDF_ITER},
+        {"kdf_threads", required_argument, NULL, OPT_KDF_THREADS},
+        {"kdf_queue", required_argument, NULL, OPT_KDF_QUEUE},
+        {"max_body", required_argument, NULL, OPT_MAX_BODY},
+        {"upload_dir", required_argument, NULL, OPT_UPLOAD_DIR},
+        {"header_timeout", required_argument, NULL, OPT_HEADER_TIMEOUT},
+        {"body_timeout", required_argument, NULL, OPT_BODY_TIMEOUT},
+        {"write_timeout", required_argument, NULL, OPT_WRITE_TIMEOUT},
+        {"keepalive_timeout", required_argument, NULL, OPT_KEEPALIVE_TIMEOUT},
+        {"max_requests", required_argument, NULL, OPT_MAX_REQUESTS},
+        {"backlog", required_argument, NULL, OPT_BACKLOG},
+        {"accept_batch", required_argument, NULL, OPT_ACCEPT_BATCH},
+        {"queue_max", required_argument, NULL, OPT_QUEUE_MAX},
+        {"codel_target", required_argument, NULL, OPT_CODEL_TARGET},
+        {"codel_interval", required_argument, NULL, OPT_CODEL_INTERVAL},
+        {"ip_rate", required_argument, NULL, OPT_IP_RATE},
+        {"ip_burst", required_argument, NULL, OPT_IP_BURST},
+        {"ip_conn_rate", required_argument, NULL, OPT_IP_CONN_RATE},
+        {"ip_conn_burst", required_argument, NULL, OPT_IP_CONN_BURST},
+        {"ip_max_conns", required_argument, NULL, OPT_IP_MAX_CONNS},
+        {"ip_table", required_argument, NULL, OPT_IP_TABLE},
+        {"admin_port", required_argument, NULL, OPT_ADMIN_PORT},
+        {"drain_timeout", required_argument, NULL, OPT_DRAIN_TIMEOUT},
+        {"reuse_port", required_argument, NULL, OPT_REUSE_PORT},
+        {NULL, 0, NULL, 0}};
+    while ((opt = getopt_long(argc, argv, str, long_opts, NULL)) != -1)
     {
         switch (opt)
         {
@@ -79,6 +226,191 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case OPT_ACCESS_SAMPLE:
+        {
+            access_sample = atoi(optarg);
+            break;
+        }
+        case OPT_LOG_COMPRESS:
+        {
+            log_compress = atoi(optarg);
+            break;
+        }
+        case OPT_LOG_MAX_FILES:
+        {
+            log_max_files = atoi(optarg);
+            break;
+        }
+        case OPT_LOG_MAX_SIZE:
+        {
+            log_max_size = atoi(optarg);
+            break;
+        }
+        case OPT_ASYNC_SQL:
+        {
+            async_sql_num = atoi(optarg);
+            break;
+        }
+        case OPT_STORE:
+        {
+            store = optarg;
+            break;
+        }
+        case OPT_STORE_FILE:
+        {
+            store_file = optarg;
+            break;
+        }
+        case OPT_STORE_LATENCY:
+        {
+            store_latency = atoi(optarg);
+            break;
+        }
+        case OPT_SQL_BATCH:
+        {
+            sql_batch = atoi(optarg);
+            break;
+        }
+        case OPT_SQL_BATCH_DELAY:
+        {
+            sql_batch_delay = atoi(optarg);
+            break;
+        }
+        case OPT_SQL_MIN:
+        {
+            sql_min = atoi(optarg);
+            break;
+        }
+        case OPT_SQL_IDLE:
+        {
+            sql_idle = atoi(optarg);
+            break;
+        }
+        case OPT_SQL_TIMEOUT:
+        {
+            sql_timeout = atoi(optarg);
+            break;
+        }
+        case OPT_KDF_ITER:
+        {
+            kdf_iter = atoi(optarg);
+            break;
+        }
+        case OPT_KDF_THREADS:
+        {
+            kdf_threads = atoi(optarg);
+            break;
+        }
+        case OPT_KDF_QUEUE:
+        {
+            kdf_queue = atoi(optarg);
+            break;
+        }
+        case OPT_MAX_BODY:
+        {
+            max_body = atoi(optarg);
+            break;
+        }
+        case OPT_UPLOAD_DIR:
+        {
+            upload_dir = optarg;
+            break;
+        }
+        case OPT_HEADER_TIMEOUT:
+        {
+            header_timeout = atoi(optarg);
+            break;
+        }
+        case OPT_BODY_TIMEOUT:
+        {
+            body_timeout = atoi(optarg);
+            break;
+        }
+        case OPT_WRITE_TIMEOUT:
+        {
+            write_timeout = atoi(optarg);
+            break;
+        }
+        case OPT_KEEPALIVE_TIMEOUT:
+        {
+            keepalive_timeout = atoi(optarg);
+            break;
+        }
+        case OPT_MAX_REQUESTS:
+        {
+            max_requests = atoi(optarg);
+            break;
+        }
+        case OPT_BACKLOG:
+        {
+            backlog = atoi(optarg);
+            break;
+        }
+        case OPT_ACCEPT_BATCH:
+        {
+            accept_batch = atoi(optarg);
+            break;
+        }
+        case OPT_QUEUE_MAX:
+        {
+            queue_max = atoi(optarg);
+            break;
+        }
+        case OPT_CODEL_TARGET:
+        {
+            codel_target = atoi(optarg);
+            break;
+        }
+        case OPT_CODEL_INTERVAL:
+        {
+            codel_interval = atoi(optarg);
+            break;
+        }
+        case OPT_IP_RATE:
+        {
+            ip_rate = atof(optarg);
+            break;
+        }
+        case OPT_IP_BURST:
+        {
+            ip_burst = atoi(optarg);
+            break;
+        }
+        case OPT_IP_CONN_RATE:
+        {
+            ip_conn_rate = atof(optarg);
+            break;
+        }
+        case OPT_IP_CONN_BURST:
+        {
+            ip_conn_burst = atoi(optarg);
+            break;
+        }
+        case OPT_IP_MAX_CONNS:
+        {
+            ip_max_conns = atoi(optarg);
+            break;
+        }
+        case OPT_IP_TABLE:
+        {
+            ip_table = atoi(optarg);
+            break;
+        }
+        case OPT_ADMIN_PORT:
+        {
+            admin_port = atoi(optarg);
+            break;
+        }
+        case OPT_DRAIN_TIMEOUT:
+        {
+            drain_timeout = atoi(optarg);
+            break;
+        }
+        case OPT_REUSE_PORT:
+        {
+            reuse_port = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
@@ -1,7 +1,10 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#include "webserver.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string>
 
 using namespace std;
 
@@ -31,9 +34,18 @@ public:
     //优雅关闭链接
     int OPT_LINGER;
 
-    //数据库连接池数量
+    //数据库连接池数量(上限)
     int sql_num;
 
+    //数据库连接池最少保持的连接数
+    int sql_min;
+
+    //空闲连接回收时间(秒)
+    int sql_idle;
+
+    //获取数据库连接的等待上限(毫秒)，超时返回503，0为一直等待
+    int sql_timeout;
+
     //线程池内的线程数量
     int thread_num;
 
@@ -42,6 +54,104 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //访问日志采样：每N个请求记录一条，0表示不记录
+    int access_sample;
+
+    //是否gzip压缩切分出的旧日志
+    int log_compress;
+
+    //旧日志保留个数，0为不限
+    int log_max_files;
+
+    //旧日志保留总大小(MB)，0为不限
+    int log_max_size;
+
+    //异步数据库连接数，0表示注册同步写库
+    int async_sql_num;
+
+    //注册合并写库：每批最多条数，0表示不合并
+    int sql_batch;
+
+    //注册合并写库：最早一条最多等待的毫秒数
+    int sql_batch_delay;
+
+    //口令PBKDF2迭代次数，0表示明文存储
+    int kdf_iter;
+
+    //口令哈希计算线程数
+    int kdf_threads;
+
+    //口令哈希计算队列上限，满时返回503
+    int kdf_queue;
+
+    //用户凭据存储后端：mysql、mmap、mock
+    string store;
+
+    //mmap后端的存储文件
+    string store_file;
+
+    //mock后端每次访问注入的延迟(微秒)
+    int store_latency;
+
+    //请求消息体上限(MB)，超过返回413
+    int max_body;
+
+    //multipart上传文件的保存目录，为空时不保存
+    string upload_dir;
+
+    //读请求头的总时长(秒)，从收到第一个字节起算
+    int header_timeout;
+
+    //读消息体时的最长空闲(秒)
+    int body_timeout;
+
+    //发送响应时的最长停顿(秒)
+    int write_timeout;
+
+    //长连接等待下一个请求的最长空闲(秒)
+    int keepalive_timeout;
+
+    //每个连接最多处理的请求数，0为不限
+    int max_requests;
+
+    //listen的backlog，0表示取系统的somaxconn
+    int backlog;
+
+    //每轮事件循环最多accept的连接数
+    int accept_batch;
+
+    //工作队列长度上限，满时直接回复503
+    int queue_max;
+
+    //CoDel排队时间目标(毫秒)，过载时排队超过2倍目标的请求回复503，0表示只按队列长度拒绝
+    int codel_target;
+
+    //CoDel统计窗口(毫秒)，窗口内最小排队时间超过目标即为过载
+    int codel_interval;
+
+    //按IP限流：每秒请求数及突发，0表示不限
+    double ip_rate;
+    int ip_burst;
+
+    //按IP限流：每秒新建连接数及突发，0表示不限
+    double ip_conn_rate;
+    int ip_conn_burst;
+
+    //按IP限流：同时打开的连接数，0表示不限
+    int ip_max_conns;
+
+    //限流表最多跟踪的IP数
+    int ip_table;
+
+    //管理端口，提供/metrics，0表示关闭
+    int admin_port;
+
+    //收到SIGTERM后排空连接的最长秒数，0表示立即退出
+    int drain_timeout;
+
+    //监听socket开启SO_REUSEPORT，滚动重启时新进程可以在旧进程排空期间绑定同一端口
+    int reuse_port;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "chunk_writer.h"
+
+static char crlf[] = "\r\n";
+static char last_chunk[] = "0\r\n\r\n";
+
+chunk_writer::chunk_writer()
+    : m_src(0), m_buf(0), m_iov_idx(0), m_iov_count(0), m_need_chunk(false), m_last(false), m_sent(0)
+{
+}
+
+chunk_writer::~chunk_writer()
+{
+    reset();
+}
+
+void chunk_writer::start(const char *head, int head_len, chunk_source *src)
+{
+    reset();
+    m_src = src;
+    m_buf = (char *)malloc(CHUNK_SIZE);
+    m_iov[0].iov_base = (void *)head;
+    m_iov[0].iov_len = head_len;
+    m_iov_idx = 0;
+    m_iov_count = 1;
+    m_need_chunk = true;
+    m_last = false;
+    m_sent = 0;
+}
+
+void chunk_writer::reset()
+{
+    delete m_src;
+    m_src = 0;
+    free(m_buf);
+    m_buf = 0;
+    m_iov_idx = 0;
+    m_iov_count = 0;
+}
+
+//生成下一块，接在尚未发出的iovec(只可能是响应头)后面，内容出错时返回false
+bool chunk_writer::next_chunk()
+{
+    int n = m_src->produce(m_buf, CHUNK_SIZE);
+    if (n < 0)
+        return false;
+
+    if (m_iov_idx >= m_iov_count)
+        m_iov_idx = m_iov_count = 0;
+    struct iovec *iov = m_iov + m_iov_count;
+    if (0 == n)
+    {
+        iov[0].iov_base = last_chunk;
+        iov[0].iov_len = sizeof(last_chunk) - 1;
+        m_iov_count += 1;
+        m_last = true;
+        return true;
+    }
+    iov[0].iov_base = m_size_line;
+    iov[0].iov_len = snprintf(m_size_line, sizeof(m_size_line), "%x\r\n", n);
+    iov[1].iov_base = m_buf;
+    iov[1].iov_len = n;
+    iov[2].iov_base = crlf;
+    iov[2].iov_len = 2;
+    m_iov_count += 3;
+    return true;
+}
+
+chunk_writer::WRITE_RESULT chunk_writer::send(int fd)
+{
+    while (true)
+    {
+        if (m_need_chunk)
+        {
+            if (!next_chunk())
+                return WRITE_ERROR;
+            m_need_chunk = false;
+        }
+
+        ssize_t n = writev(fd, m_iov + m_iov_idx, m_iov_count - m_iov_idx);
+        if (n < 0)
+        {
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                return WRITE_AGAIN;
+            if (EINTR == errno)
+                continue;
+            return WRITE_ERROR;
+        }
+        m_sent += n;
+
+        //跳过已发完的iovec，部分发出的调整起点
+        while (m_iov_idx < m_iov_count && (size_t)n >= m_iov[m_iov_idx].iov_len)
+        {
+            n -= m_iov[m_iov_idx].iov_len;
+            ++m_iov_idx;
+        }
+        if (n > 0)
+        {
+            m_iov[m_iov_idx].iov_base = (char *)m_iov[m_iov_idx].iov_base + n;
+            m_iov[m_iov_idx].iov_len -= n;
+        }
+
+        //当前块发完，最后一块发完即结束，否则要下一块
+        if (m_iov_idx >= m_iov_count)
+        {
+            if (m_last)
+                return WRITE_DONE;
+            m_need_chunk = true;
+        }
+    }
+}
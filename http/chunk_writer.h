@@ -0,0 +1,57 @@
+#ifndef CHUNK_WRITER_H
+#define CHUNK_WRITER_H
+
+#include <sys/uio.h>
+
+//分块响应的内容来源，由处理函数实现，发送完毕或连接关闭时由chunk_writer释放
+class chunk_source
+{
+public:
+    virtual ~chunk_source() {}
+    //把下一段内容写入buf，返回写入的字节数，0表示内容结束，-1表示出错
+    virtual int produce(char *buf, int size) = 0;
+};
+
+/*************************************************************
+*Transfer-Encoding: chunked响应
+*套接字可写时才向chunk_source要下一块，每块加上长度行和\r\n后用一次writev发出，
+*响应头随第一块一起发送，首字节时间与响应总大小无关，内存只占一个块
+**************************************************************/
+class chunk_writer
+{
+public:
+    static const int CHUNK_SIZE = 8192;
+
+    enum WRITE_RESULT
+    {
+        WRITE_DONE = 0, //最后一块已发出
+        WRITE_AGAIN,    //套接字缓冲区满，等待EPOLLOUT
+        WRITE_ERROR
+    };
+
+    chunk_writer();
+    ~chunk_writer();
+
+    //开始发送，head为响应头(已含Transfer-Encoding: chunked和空行)，需保持有效直到发送完毕
+    void start(const char *head, int head_len, chunk_source *src);
+    //释放内容来源和块缓冲区
+    void reset();
+    bool active() const { return m_src != 0; }
+    WRITE_RESULT send(int fd);
+    long long bytes_sent() const { return m_sent; }
+
+private:
+    bool next_chunk();
+
+    chunk_source *m_src;
+    char *m_buf;
+    char m_size_line[24];
+    struct iovec m_iov[4]; //响应头、长度行、数据、\r\n(最后一块为0\r\n\r\n)
+    int m_iov_idx;
+    int m_iov_count;
+    bool m_need_chunk;      //上一块已发完，要生成下一块
+    bool m_last;            //最后一块已生成
+    long long m_sent;
+};
+
+#endif
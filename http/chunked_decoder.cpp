@@ -0,0 +1,140 @@
+#include <string.h>
+#include "chunked_decoder.h"
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+void chunked_decoder::reset()
+{
+    m_state = STATE_SIZE;
+    m_size = 0;
+    m_digits = 0;
+    m_line = 0;
+}
+
+long chunked_decoder::decode(char *data, size_t len, size_t &out)
+{
+    size_t i = 0;
+    out = 0;
+    while (i < len && m_state != STATE_DONE)
+    {
+        char c = data[i];
+        switch (m_state)
+        {
+        case STATE_SIZE:
+        {
+            int v = hex_digit(c);
+            if (v >= 0)
+            {
+                //最多15位，块大小不会溢出
+                if (++m_digits > 15)
+                    return -1;
+                m_size = m_size << 4 | v;
+            }
+            else if (0 == m_digits)
+                return -1;
+            else if ('\r' == c)
+                m_state = STATE_SIZE_LF;
+            else if (';' == c || ' ' == c || '\t' == c)
+            {
+                m_state = STATE_EXT;
+                m_line = 0;
+            }
+            else
+                return -1;
+            ++i;
+            break;
+        }
+        case STATE_EXT:
+        {
+            if ('\r' == c)
+                m_state = STATE_SIZE_LF;
+            else if (++m_line > MAX_LINE)
+                return -1;
+            ++i;
+            break;
+        }
+        case STATE_SIZE_LF:
+        {
+            if (c != '\n')
+                return -1;
+            ++i;
+            m_digits = 0;
+            //大小为0的块是最后一块，后面是尾部字段
+            m_state = m_size > 0 ? STATE_DATA : STATE_TRAILER;
+            break;
+        }
+        case STATE_DATA:
+        {
+            size_t n = len - i;
+            if (n > m_size)
+                n = m_size;
+            if (out != i)
+                memmove(data + out, data + i, n);
+            out += n;
+            i += n;
+            m_size -= n;
+            if (0 == m_size)
+                m_state = STATE_DATA_CR;
+            break;
+        }
+        case STATE_DATA_CR:
+        {
+            if (c != '\r')
+                return -1;
+            ++i;
+            m_state = STATE_DATA_LF;
+            break;
+        }
+        case STATE_DATA_LF:
+        {
+            if (c != '\n')
+                return -1;
+            ++i;
+            m_state = STATE_SIZE;
+            break;
+        }
+        case STATE_TRAILER:
+        {
+            if ('\r' == c)
+                m_state = STATE_END_LF;
+            else
+            {
+                m_state = STATE_TRAILER_LINE;
+                m_line = 1;
+            }
+            ++i;
+            break;
+        }
+        case STATE_TRAILER_LINE:
+        {
+            if ('\r' == c)
+                m_state = STATE_TRAILER_LF;
+            else if (++m_line > MAX_LINE)
+                return -1;
+            ++i;
+            break;
+        }
+        case STATE_TRAILER_LF:
+        case STATE_END_LF:
+        {
+            if (c != '\n')
+                return -1;
+            ++i;
+            m_state = STATE_TRAILER_LF == m_state ? STATE_TRAILER : STATE_DONE;
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,46 @@
+#ifndef CHUNKED_DECODER_H
+#define CHUNKED_DECODER_H
+
+#include <stddef.h>
+
+/*************************************************************
+*Transfer-Encoding: chunked请求体的增量解码
+*逐字节的状态机，块大小行、块扩展和尾部字段都不缓存，可以在任意位置被切断
+*块数据就地前移到送入缓冲区的开头，交给后面的消息体处理，不做额外拷贝
+**************************************************************/
+class chunked_decoder
+{
+public:
+    static const size_t MAX_LINE = 4096; //块扩展和每个尾部字段的长度上限
+
+    chunked_decoder() { reset(); }
+
+    void reset();
+    //解码data中的len个字节，解出的块数据移到data开头，长度存入out
+    //返回消耗的字节数，读完最后一个块和尾部后即停止，格式错误返回-1
+    long decode(char *data, size_t len, size_t &out);
+    bool done() const { return STATE_DONE == m_state; }
+
+private:
+    enum STATE
+    {
+        STATE_SIZE = 0,     //块大小(十六进制)
+        STATE_EXT,          //块扩展，忽略
+        STATE_SIZE_LF,
+        STATE_DATA,
+        STATE_DATA_CR,      //块数据后的\r\n
+        STATE_DATA_LF,
+        STATE_TRAILER,      //尾部字段的行首，空行表示结束
+        STATE_TRAILER_LINE,
+        STATE_TRAILER_LF,
+        STATE_END_LF,
+        STATE_DONE
+    };
+
+    STATE m_state;
+    unsigned long long m_size; //当前块剩余字节数
+    int m_digits;
+    size_t m_line;             //当前扩展或尾部字段已读长度
+};
+
+#endif
@@ -0,0 +1,318 @@
+#include <string.h>
+#include <strings.h>
+#include "form_parser.h"
+
+bool str_view::equals(const char *s) const
+{
+    return strlen(s) == len && memcmp(ptr, s, len) == 0;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+//就地解码+和%XX，返回解码后的长度，不合法的%原样保留
+static size_t url_decode(char *s, size_t len)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if ('+' == s[i])
+            s[out++] = ' ';
+        else if ('%' == s[i] && i + 2 < len && hex_value(s[i + 1]) >= 0 && hex_value(s[i + 2]) >= 0)
+        {
+            s[out++] = hex_value(s[i + 1]) << 4 | hex_value(s[i + 2]);
+            i += 2;
+        }
+        else
+            s[out++] = s[i];
+    }
+    return out;
+}
+
+form_parser::form_parser()
+{
+    m_type = TYPE_NONE;
+    m_cb = NULL;
+    m_arg = NULL;
+    m_state = PART_PREAMBLE;
+    m_matched = 0;
+    m_part_first = false;
+}
+
+bool form_parser::init(const char *content_type, form_cb cb, void *arg)
+{
+    m_cb = cb;
+    m_arg = arg;
+    m_pending.clear();
+    m_tail.clear();
+    m_part_name.clear();
+    m_part_filename.clear();
+    m_type = TYPE_NONE;
+
+    if (NULL == content_type || strncasecmp(content_type, "application/x-www-form-urlencoded", 33) == 0)
+    {
+        m_type = TYPE_URLENCODED;
+        return true;
+    }
+    if (strncasecmp(content_type, "multipart/form-data", 19) != 0)
+        return false;
+
+    //boundary参数，可能带引号
+    const char *p = strcasestr(content_type, "boundary=");
+    if (!p)
+        return false;
+    p += 9;
+    size_t n;
+    if ('"' == *p)
+    {
+        ++p;
+        const char *q = strchr(p, '"');
+        if (!q)
+            return false;
+        n = q - p;
+    }
+    else
+        n = strcspn(p, "; \t");
+    if (0 == n || n > 70)
+        return false;
+
+    m_type = TYPE_MULTIPART;
+    m_delim = "\r\n--";
+    m_delim.append(p, n);
+    //消息体开头的分隔符前面没有\r\n，视作已经匹配了这两个字节
+    m_state = PART_PREAMBLE;
+    m_matched = 2;
+    return true;
+}
+
+bool form_parser::feed(char *data, size_t len)
+{
+    if (TYPE_URLENCODED == m_type)
+        return feed_urlencoded(data, len);
+    if (TYPE_MULTIPART == m_type)
+        return feed_multipart(data, len);
+    return false;
+}
+
+bool form_parser::finish()
+{
+    if (TYPE_URLENCODED == m_type)
+    {
+        bool ret = m_pending.empty() || emit_pair(&m_pending[0], m_pending.size());
+        m_pending.clear();
+        return ret;
+    }
+    return TYPE_MULTIPART == m_type && PART_DONE == m_state;
+}
+
+bool form_parser::feed_urlencoded(char *data, size_t len)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (data[i] != '&')
+            continue;
+        //完整落在本段内的字段直接在原缓冲区上解码输出
+        if (m_pending.empty())
+        {
+            if (!emit_pair(data + start, i - start))
+                return false;
+        }
+        else
+        {
+            if (m_pending.size() + i - start > MAX_FIELD)
+                return false;
+            m_pending.append(data + start, i - start);
+            if (!emit_pair(&m_pending[0], m_pending.size()))
+                return false;
+            m_pending.clear();
+        }
+        start = i + 1;
+    }
+
+    //最后一个字段可能还没收完
+    if (m_pending.size() + len - start > MAX_FIELD)
+        return false;
+    m_pending.append(data + start, len - start);
+    return true;
+}
+
+bool form_parser::emit_pair(char *pair, size_t len)
+{
+    if (0 == len)
+        return true;
+    char *eq = (char *)memchr(pair, '=', len);
+    size_t name_len = eq ? eq - pair : len;
+    char *value = eq ? eq + 1 : pair + len;
+    size_t value_len = eq ? len - name_len - 1 : 0;
+
+    form_part part;
+    part.name.ptr = pair;
+    part.name.len = url_decode(pair, name_len);
+    part.filename.ptr = "";
+    part.filename.len = 0;
+    part.data.ptr = value;
+    part.data.len = url_decode(value, value_len);
+    part.first = true;
+    part.last = true;
+    return m_cb(m_arg, part);
+}
+
+bool form_parser::feed_multipart(char *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && m_state != PART_DONE)
+    {
+        //1. 分隔符之后：--表示结束，\r\n表示后面是下一部分的头
+        if (PART_DELIM_TAIL == m_state)
+        {
+            char c = data[i++];
+            if (m_tail.empty() && (' ' == c || '\t' == c))
+                continue;
+            m_tail += c;
+            if (m_tail.size() < 2)
+                continue;
+            if ("--" == m_tail)
+                m_state = PART_DONE;
+            else if ("\r\n" == m_tail)
+            {
+                m_state = PART_HEADERS;
+                m_part_name.clear();
+                m_part_filename.clear();
+                m_pending.clear();
+            }
+            else
+                return false;
+            m_tail.clear();
+        }
+        //2. 部分头，逐行拼接，空行表示头结束
+        else if (PART_HEADERS == m_state)
+        {
+            char *end = (char *)memchr(data + i, '\n', len - i);
+            size_t n = end ? end - (data + i) + 1 : len - i;
+            if (m_pending.size() + n > MAX_FIELD)
+                return false;
+            m_pending.append(data + i, n);
+            i += n;
+            if (!end)
+                continue;
+
+            size_t line_len = m_pending.size() - 1;
+            if (line_len > 0 && '\r' == m_pending[line_len - 1])
+                --line_len;
+            if (0 == line_len)
+            {
+                m_state = PART_DATA;
+                m_part_first = true;
+                m_matched = 0;
+            }
+            else if (!header_line(m_pending.substr(0, line_len)))
+                return false;
+            m_pending.clear();
+        }
+        //3. 前言或部分数据，查找分隔符
+        //分隔符只在开头有一个\r，匹配失败时只需看当前字节是否为\r，不必回退
+        else
+        {
+            bool emit = PART_DATA == m_state;
+            size_t from_prev = m_matched; //上一段末尾暂缓输出的字节数，内容即分隔符的前缀
+            size_t start = i;
+            while (i < len)
+            {
+                if (data[i] == m_delim[m_matched])
+                {
+                    ++i;
+                    if (++m_matched < m_delim.size())
+                        continue;
+                    //找到分隔符，之前的数据是本部分的最后一段
+                    size_t in_chunk = m_delim.size() - from_prev;
+                    if (emit && !emit_data(data + start, i - in_chunk - start, true))
+                        return false;
+                    m_matched = 0;
+                    m_state = PART_DELIM_TAIL;
+                    break;
+                }
+                if (m_matched > 0)
+                {
+                    //部分匹配失败，上一段暂缓的字节其实是数据
+                    if (emit && from_prev > 0 && !emit_data(m_delim.data(), from_prev, false))
+                        return false;
+                    from_prev = 0;
+                    m_matched = 0;
+                    continue;
+                }
+                ++i;
+            }
+            if (PART_DELIM_TAIL == m_state)
+                continue;
+
+            //本段结束，末尾可能是分隔符前缀的字节暂不输出
+            size_t keep = m_matched - from_prev;
+            if (emit && !emit_data(data + start, len - keep - start, false))
+                return false;
+        }
+    }
+    return true;
+}
+
+//只关心Content-Disposition中的name和filename
+bool form_parser::header_line(const string &line)
+{
+    if (strncasecmp(line.c_str(), "Content-Disposition:", 20) != 0)
+        return true;
+
+    const char *keys[2] = {"name=", "filename="};
+    string *values[2] = {&m_part_name, &m_part_filename};
+    for (int k = 0; k < 2; ++k)
+    {
+        //参数前必须是;或空白，避免name=匹配到filename=
+        const char *p = line.c_str() + 20;
+        size_t key_len = strlen(keys[k]);
+        while ((p = strcasestr(p, keys[k])) != NULL)
+        {
+            if (p[-1] == ';' || p[-1] == ' ' || p[-1] == '\t')
+                break;
+            p += key_len;
+        }
+        if (!p)
+            continue;
+        p += key_len;
+        if ('"' == *p)
+        {
+            ++p;
+            const char *q = strchr(p, '"');
+            if (!q)
+                return false;
+            values[k]->assign(p, q - p);
+        }
+        else
+            values[k]->assign(p, strcspn(p, "; \t"));
+    }
+    return true;
+}
+
+bool form_parser::emit_data(const char *data, size_t len, bool last)
+{
+    if (0 == len && !last)
+        return true;
+
+    form_part part;
+    part.name.ptr = m_part_name.c_str();
+    part.name.len = m_part_name.size();
+    part.filename.ptr = m_part_filename.c_str();
+    part.filename.len = m_part_filename.size();
+    part.data.ptr = data;
+    part.data.len = len;
+    part.first = m_part_first;
+    part.last = last;
+    m_part_first = false;
+    return m_cb(m_arg, part);
+}
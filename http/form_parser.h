@@ -0,0 +1,89 @@
+#ifndef FORM_PARSER_H
+#define FORM_PARSER_H
+
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+//指向已有缓冲区的一段字符，不拥有内存，回调返回后即失效
+struct str_view
+{
+    const char *ptr;
+    size_t len;
+
+    bool equals(const char *s) const;
+};
+
+//字段值的一段：urlencoded字段和不跨块的multipart字段一次给出(first和last都为true)，
+//上传文件等大字段按到达顺序分多段给出
+struct form_part
+{
+    str_view name;
+    str_view filename; //multipart中的上传文件名，其余为空
+    str_view data;
+    bool first;
+    bool last;
+};
+
+//返回false中止解析
+typedef bool (*form_cb)(void *arg, const form_part &part);
+
+/*************************************************************
+*增量表单解析：消息体分段到达时逐段送入，不需要整体缓存
+*application/x-www-form-urlencoded：按&切分，+和%XX就地解码，
+*    跨段的字段先拼到内部缓冲区，单个字段不超过MAX_FIELD
+*multipart/form-data：按分隔符切分各部分，部分头跨段时拼接，
+*    部分数据直接引用送入的缓冲区，只有可能是分隔符前缀的几个字节会暂存
+**************************************************************/
+class form_parser
+{
+public:
+    static const size_t MAX_FIELD = 8192;
+
+    form_parser();
+
+    //按Content-Type初始化，content_type为NULL时按urlencoded处理，不支持的类型返回false
+    bool init(const char *content_type, form_cb cb, void *arg);
+    //送入一段消息体，data会被就地解码修改，格式错误或回调中止时返回false
+    bool feed(char *data, size_t len);
+    //消息体结束，输出最后一个字段，multipart未见到结束分隔符时返回false
+    bool finish();
+
+private:
+    enum TYPE
+    {
+        TYPE_NONE = 0,
+        TYPE_URLENCODED,
+        TYPE_MULTIPART
+    };
+    enum PART_STATE
+    {
+        PART_PREAMBLE = 0, //第一个分隔符之前
+        PART_DELIM_TAIL,   //分隔符之后的--或\r\n
+        PART_HEADERS,
+        PART_DATA,
+        PART_DONE
+    };
+
+    bool feed_urlencoded(char *data, size_t len);
+    bool emit_pair(char *pair, size_t len);
+    bool feed_multipart(char *data, size_t len);
+    bool header_line(const string &line);
+    bool emit_data(const char *data, size_t len, bool last);
+
+    TYPE m_type;
+    form_cb m_cb;
+    void *m_arg;
+    string m_pending; //urlencoded：跨段的字段；multipart：跨段的部分头行
+
+    string m_delim;       //\r\n--boundary
+    PART_STATE m_state;
+    size_t m_matched;     //已匹配的分隔符前缀长度(跨段)
+    string m_tail;        //分隔符后已收到的字节
+    string m_part_name;
+    string m_part_filename;
+    bool m_part_first;
+};
+
+#endif
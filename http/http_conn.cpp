@@ -1,7 +1,9 @@
 #include "http_conn.h"
 
-#include <mysql/mysql.h>
 #include <fstream>
+#include <atomic>
+#include <sys/time.h>
+#include <ctype.h>
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
@@ -11,44 +13,81 @@ const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request body is larger than the server is willing to process.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_429_title = "Too Many Requests";
+const char *error_429_form = "You have sent too many requests, please slow down.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is temporarily unable to handle the request, please retry later.\n";
 
-locker m_lock;
-map<string, string> users;
+//与METHOD枚举一一对应，用于访问日志
+const char *method_name[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
 
-void http_conn::initmysql_result(connection_pool *connPool)
+//过载时回复的503，整条响应只生成一次
+static const string &shed_response()
 {
-    //先从连接池中取一个连接
-    MYSQL *mysql = NULL;
-    //利用RAII机制
-    //RAII:对资源的申请、释放这一成对操作进行封装
-    connectionRAII mysqlcon(&mysql, connPool); 
-
-    //在user表中检索username，passwd数据，浏览器端输入
-    //mysql_query:是 MySQL C API 中用于执行 SQL 语句的函数
-    //返回 0 代表执行成功，非 0 代表失败
-    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    //从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
+    static const string response = string("HTTP/1.1 503 ") + error_503_title + "\r\n"
+        + "Retry-After:1\r\n"
+        + "Content-Length:" + std::to_string(strlen(error_503_form)) + "\r\n"
+        + "Connection:close\r\n\r\n"
+        + error_503_form;
+    return response;
+}
 
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
+//访问日志采样计数
+static std::atomic<unsigned int> access_seq(0);
+//连接编号
+static std::atomic<unsigned int> conn_seq(0);
 
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
+//异步注册的上下文，回调时连接可能已经关闭或被复用
+struct register_ctx
+{
+    http_conn *conn;
+    unsigned int conn_id;
+};
 
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
+//交给计算线程的登录/注册，口令和存储串都保存副本
+struct auth_ctx
+{
+    auth_ctx(http_conn *c, bool reg, const char *n, const char *p)
+        : conn(c), conn_id(c->get_conn_id()), is_register(reg), name(n), passwd(p), ok(false), result(0) {}
+
+    http_conn *conn;
+    unsigned int conn_id;
+    bool is_register;
+    string name;
+    string passwd;
+    string stored; //登录：库中的存储串
+    bool ok;       //登录：校验是否通过
+    int result;    //注册：user_store::STORE_*
+};
+
+//管理端口的文本页(指标、跟踪记录)：构造时生成一次，之后按块发出
+class text_source : public chunk_source
+{
+public:
+    text_source(void (*render)(string &)) : m_pos(0) { render(m_text); }
+    int produce(char *buf, int size)
     {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+        int n = m_text.size() - m_pos < (size_t)size ? m_text.size() - m_pos : size;
+        memcpy(buf, m_text.data() + m_pos, n);
+        m_pos += n;
+        return n;
     }
+
+private:
+    string m_text;
+    size_t m_pos;
+};
+
+//当前时间，微秒
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
 }
 
 //对文件描述符设置非阻塞
@@ -61,6 +100,7 @@ int setnonblocking(int fd)
 }
 
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
+//连接由accept4创建时已设为非阻塞，不再调用fcntl
 void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
 {
     epoll_event event;
@@ -74,7 +114,6 @@ void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     if (one_shot)
         event.events |= EPOLLONESHOT;
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
 }
 
 //从内核时间表删除描述符
@@ -98,8 +137,21 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_epollfd = -1;
+int http_conn::m_access_sample = 0;
+user_store *http_conn::m_store = NULL;
+compute_pool *http_conn::m_kdf_pool = NULL;
+int http_conn::m_kdf_iter = 0;
+long long http_conn::m_max_body = 64LL * 1024 * 1024;
+string http_conn::m_upload_dir;
+int http_conn::m_header_timeout = 15;
+int http_conn::m_body_timeout = 15;
+int http_conn::m_write_timeout = 15;
+int http_conn::m_keepalive_timeout = 15;
+int http_conn::m_max_requests = 0;
+std::atomic<bool> http_conn::m_draining(false);
+rate_limiter *http_conn::m_limiter = NULL;
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -109,8 +161,16 @@ void http_conn::close_conn(bool real_close)
         printf("close %d\n", m_sockfd);
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
+        //作废等待中的异步回调(存储写入、口令哈希)，编号从1开始，0不会与任何回调匹配
+        m_conn_id = 0;
         m_user_count--;
+        if (m_limiter)
+            m_limiter->on_close(m_address.sin_addr.s_addr);
     }
+    //响应没发完就被关闭时文件仍处于映射中
+    unmap();
+    abort_upload();
+    m_chunk_out.reset();
 }
 
 //初始化连接,外部调用初始化套接字地址
@@ -119,19 +179,26 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_TRIGMode = TRIGMode;
 
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
 
     strcpy(sql_user, user.c_str());
     strcpy(sql_passwd, passwd.c_str());
     strcpy(sql_name, sqlname.c_str());
 
+    m_ts_accept = now_us();
+    m_conn_id = ++conn_seq;
+    m_requests = 0;
+    m_admin = false;
+    m_read_idx = 0;
+    m_checked_idx = 0;
+
     init();
 }
 
@@ -139,7 +206,14 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
+    //上一个请求完整解析后已读入的字节属于下一个流水线请求，移到缓冲区开头
+    long left = 0;
+    if (m_ts_parsed && m_read_idx > m_checked_idx)
+    {
+        left = m_read_idx - m_checked_idx;
+        memmove(m_read_buf, m_read_buf + m_checked_idx, left);
+    }
+
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
@@ -148,17 +222,36 @@ void http_conn::init()
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_chunked = false;
+    m_expect_continue = false;
+    m_content_type = 0;
+    m_body_read = 0;
+    m_form_user[0] = '\0';
+    m_form_passwd[0] = '\0';
+    m_form_overflow = false;
+    abort_upload();
+    m_upload_size = 0;
+    m_chunk_out.reset();
+    delete m_chunk_src;
+    m_chunk_src = NULL;
+    m_chunk_type = NULL;
+    m_upload_error = false;
     m_host = 0;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
+    m_read_idx = left;
     m_write_idx = 0;
     cgi = 0;
     m_state = 0;
     timer_flag = 0;
     improv = 0;
+    m_status = 0;
+    m_ts_first_read = left ? now_us() : 0;
+    m_ts_parsed = 0;
+    m_ts_handled = 0;
+    m_req_path[0] = '\0';
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
+    memset(m_read_buf + left, '\0', READ_BUFFER_SIZE - left);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
 }
@@ -227,6 +320,7 @@ http_conn::LINE_STATUS http_conn::parse_line()
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
 {
+    TRACE_SCOPE(T_READ, m_conn_id);
     if (m_read_idx >= READ_BUFFER_SIZE)
     {
         return false;
@@ -243,6 +337,11 @@ bool http_conn::read_once()
         {
             return false;
         }
+        if (0 == m_ts_first_read)
+        {
+            m_ts_first_read = now_us();
+            WS_PROBE2(request_start, m_conn_id, m_sockfd);
+        }
 
         return true;
     }
@@ -251,6 +350,9 @@ bool http_conn::read_once()
     {
         while (true)
         {
+            //缓冲区满时先交给解析，消息体解析后会回收缓冲区，重新注册EPOLLIN时仍有数据可读会再次触发
+            if (m_read_idx >= READ_BUFFER_SIZE)
+                break;
             bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
             if (bytes_read == -1)
             {
@@ -262,6 +364,11 @@ bool http_conn::read_once()
             {
                 return false;
             }
+            if (0 == m_ts_first_read)
+            {
+                m_ts_first_read = now_us();
+                WS_PROBE2(request_start, m_conn_id, m_sockfd);
+            }
             m_read_idx += bytes_read;
         }
         return true;
@@ -287,7 +394,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     //将该位置改为\0（结束符），用于将前面的数据分离出来
     *m_url++ = '\0';
 
-    //2. 获取method：请求方法，本项目中只支持GET和POST
+    //2. 获取method：请求方法，本项目中支持GET、POST、HEAD和OPTIONS
+    //HEAD与GET处理相同但不发送消息体，OPTIONS供负载均衡做健康检查，不访问文件
     char *method = text;
     if (strcasecmp(method, "GET") == 0)
         m_method = GET;
@@ -296,6 +404,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         m_method = POST;
         cgi = 1;
     }
+    else if (strcasecmp(method, "HEAD") == 0)
+        m_method = HEAD;
+    else if (strcasecmp(method, "OPTIONS") == 0)
+        m_method = OPTIONS;
     else
         return BAD_REQUEST;
 
@@ -313,6 +425,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if (strcasecmp(m_version, "HTTP/1.1") != 0)
         return BAD_REQUEST;
 
+    //OPTIONS *表示询问整个服务器
+    if (OPTIONS == m_method && strcmp(m_url, "*") == 0)
+    {
+        snprintf(m_req_path, FILENAME_LEN, "%s", m_url);
+        m_check_state = CHECK_STATE_HEADER;
+        return NO_REQUEST;
+    }
+
     //对请求资源前7个字符进行判断
     //这里主要是有些报文的请求资源中会带有http://，这里需要对这种情况进行单独处理
     if (strncasecmp(m_url, "http://", 7) == 0)
@@ -335,6 +455,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         return BAD_REQUEST;
     if (strlen(m_url) == 1)
         strcat(m_url, "judge.html");//将url追加到字符串中
+    snprintf(m_req_path, FILENAME_LEN, "%s", m_url);
 
     //5. 请求行解析完毕，主状态机由CHECK_STATE_REQUESTLINE转移到CHECK_STATE_HEADER，解析请求头
     m_check_state = CHECK_STATE_HEADER;
@@ -349,8 +470,23 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         // 判断 GET 还是 POST 请求
         //空行后通过头部字段中的Content-Length字段判断
         //请求报文是否包含消息体（GET命令中Content-Length为0，POST非0）
-        if (m_content_length != 0) { // POST 请求
-            // POST 需跳转到 消息体 处理状态
+        //同时带Content-Length和chunked的请求可能被前后两端按不同长度理解，直接拒绝
+        if (m_content_length < 0 || (m_chunked && m_content_length != 0))
+            return BAD_REQUEST;
+        if (m_content_length > m_max_body)
+            return ENTITY_TOO_LARGE;
+        if (m_content_length != 0 || m_chunked) { // POST 请求
+            // POST 需跳转到 消息体 处理状态，按 Content-Type 准备表单解析器
+            if (!m_form.init(m_content_type, on_form_field, this))
+                return BAD_REQUEST;
+            m_chunk.reset();
+            //客户端在等待确认后才发送消息体，尽力回复一次，发不出去客户端超时后也会继续发送
+            if (m_expect_continue)
+            {
+                const char *cont = "HTTP/1.1 100 Continue\r\n\r\n";
+                ssize_t ret = send(m_sockfd, cont, strlen(cont), MSG_NOSIGNAL);
+                (void)ret;
+            }
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
@@ -370,11 +506,33 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
  
     // 解析请求头部 内容长度字段
     else if (strncasecmp(text, "Content-length:", 15) == 0) {
-        text += 15；
+        text += 15;
         text += strspn(text, " \t");
         m_content_length = atol(text);
     }
  
+    // 解析请求头部 传输编码字段，只支持chunked
+    else if (strncasecmp(text, "Transfer-Encoding:", 18) == 0) {
+        text += 18;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "chunked") != 0)
+            return BAD_REQUEST;
+        m_chunked = true;
+    }
+
+    else if (strncasecmp(text, "Expect:", 7) == 0) {
+        text += 7;
+        text += strspn(text, " \t");
+        m_expect_continue = strcasecmp(text, "100-continue") == 0;
+    }
+
+    // 解析请求头部 内容类型字段
+    else if (strncasecmp(text, "Content-Type:", 13) == 0) {
+        text += 13;
+        text += strspn(text, " \t");
+        m_content_type = text;
+    }
+ 
     // 解析请求头部 HOST字段
     else if (strncasecmp(text, "Host:", 5) == 0) {
         text += 5;
@@ -387,17 +545,154 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     return NO_REQUEST;
 }
 
-//判断http请求是否被完整读入
+//把新收到的消息体送入表单解析器，全部送完即请求完整
+//送入后的数据不再需要，读缓冲区退回消息体起点，消息体大小因此不受缓冲区限制
+//chunked消息体先就地解码，解出的块数据同样送入表单解析器
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    long avail = m_read_idx - m_checked_idx;
+    long used = avail; //属于本请求消息体的字节数
+    long n = avail;
+    if (m_chunked)
     {
-        text[m_content_length] = '\0';
-        //POST请求中最后为输入的用户名和密码
-        m_string = text;
-        return GET_REQUEST;
+        size_t out;
+        used = m_chunk.decode(text, avail, out);
+        if (used < 0)
+            return BAD_REQUEST;
+        n = out;
+        if (m_body_read + n > m_max_body)
+            return ENTITY_TOO_LARGE;
+    }
+    else if (n > m_content_length - m_body_read)
+        used = n = m_content_length - m_body_read;
+    if (n > 0 && !m_form.feed(text, n))
+        return m_upload_error ? INTERNAL_ERROR : BAD_REQUEST;
+    m_body_read += n;
+    //已处理的消息体回收缓冲区，之后的字节属于下一个流水线请求，前移到m_checked_idx
+    if (used < avail)
+        memmove(text, text + used, avail - used);
+    m_read_idx = m_checked_idx + (avail - used);
+
+    if (m_chunked ? !m_chunk.done() : m_body_read < m_content_length)
+        return NO_REQUEST;
+    if (!m_form.finish() || m_form_overflow)
+        return BAD_REQUEST;
+    return GET_REQUEST;
+}
+
+bool http_conn::on_form_field(void *arg, const form_part &part)
+{
+    http_conn *conn = (http_conn *)arg;
+    if (part.filename.len > 0)
+        return conn->upload_part(part);
+
+    char *dst;
+    if (part.name.equals("user"))
+        dst = conn->m_form_user;
+    else if (part.name.equals("password"))
+        dst = conn->m_form_passwd;
+    else
+        return true;
+
+    //multipart中的值可能分多段到达
+    size_t used = part.first ? 0 : strlen(dst);
+    if (used + part.data.len >= sizeof(conn->m_form_user))
+    {
+        conn->m_form_overflow = true;
+        return false;
+    }
+    memcpy(dst + used, part.data.ptr, part.data.len);
+    dst[used + part.data.len] = '\0';
+    return true;
+}
+
+//上传文件边收边写盘，每个连接只占用读缓冲区，与文件大小无关
+//未配置上传目录时数据直接丢弃
+bool http_conn::upload_part(const form_part &part)
+{
+    if (m_upload_dir.empty())
+        return true;
+
+    if (part.first)
+    {
+        abort_upload();
+        snprintf(m_upload_tmp, FILENAME_LEN, "%s/.upload.XXXXXX", m_upload_dir.c_str());
+        m_upload_fd = mkostemp(m_upload_tmp, O_CLOEXEC);
+        if (m_upload_fd < 0)
+        {
+            LOG_ERROR("upload: create %s failed: %s", m_upload_tmp, strerror(errno));
+            m_upload_error = true;
+            return false;
+        }
+        m_upload_size = 0;
+    }
+    if (m_upload_fd < 0)
+        return false;
+
+    const char *p = part.data.ptr;
+    size_t left = part.data.len;
+    while (left > 0)
+    {
+        ssize_t n = ::write(m_upload_fd, p, left);
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+        {
+            LOG_ERROR("upload: write %s failed: %s", m_upload_tmp, strerror(errno));
+            m_upload_error = true;
+            abort_upload();
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    m_upload_size += part.data.len;
+    if (!part.last)
+        return true;
+
+    //文件名只取最后一段，非[A-Za-z0-9._-]的字符和开头的.都换成_，不会写到上传目录之外
+    size_t start = 0;
+    for (size_t i = 0; i < part.filename.len; ++i)
+        if ('/' == part.filename.ptr[i] || '\\' == part.filename.ptr[i])
+            start = i + 1;
+    char name[100];
+    size_t len = 0;
+    for (size_t i = start; i < part.filename.len && len < sizeof(name) - 1; ++i)
+    {
+        char c = part.filename.ptr[i];
+        bool ok = isalnum((unsigned char)c) || '-' == c || '_' == c || ('.' == c && len > 0);
+        name[len++] = ok ? c : '_';
+    }
+    name[len] = '\0';
+    if (0 == len)
+    {
+        abort_upload();
+        return true;
+    }
+
+    char path[FILENAME_LEN];
+    snprintf(path, FILENAME_LEN, "%s/%s", m_upload_dir.c_str(), name);
+    close(m_upload_fd);
+    m_upload_fd = -1;
+    if (rename(m_upload_tmp, path) < 0)
+    {
+        LOG_ERROR("upload: rename to %s failed: %s", path, strerror(errno));
+        unlink(m_upload_tmp);
+        m_upload_error = true;
+        return false;
+    }
+    LOG_INFO("upload: saved %s, %lld bytes", path, m_upload_size);
+    return true;
+}
+
+void http_conn::abort_upload()
+{
+    if (m_upload_fd >= 0)
+    {
+        close(m_upload_fd);
+        unlink(m_upload_tmp);
+        m_upload_fd = -1;
     }
-    return NO_REQUEST;
 }
 
 //主状态机，用于处理解析读取到的报文
@@ -438,17 +733,22 @@ http_conn::HTTP_CODE http_conn::process_read()
             if(ret == BAD_REQUEST){
                 return BAD_REQUEST;
             }
+            //请求行解析完即按来源IP计数，超限的请求不再解析请求头
+            if(m_limiter && !m_limiter->on_request(m_address.sin_addr.s_addr)){
+                return TOO_MANY_REQUESTS;
+            }
             break;
         }
         //2. 解析请求头
         case CHECK_STATE_HEADER:
         {
             ret = parse_headers(text);
-            if(ret == BAD_REQUEST){
-                return BAD_REQUEST;
+            if(ret == BAD_REQUEST || ret == ENTITY_TOO_LARGE){
+                return ret;
             }
             //------------------------------
             else if(ret == GET_REQUEST){
+                m_ts_parsed = now_us();
                 return do_request();
             }
             break;
@@ -457,8 +757,12 @@ http_conn::HTTP_CODE http_conn::process_read()
         case CHECK_STATE_CONTENT:
         {
             ret = parse_content(text);
+            if(ret == BAD_REQUEST || ret == ENTITY_TOO_LARGE || ret == INTERNAL_ERROR){
+                return ret;
+            }
             //------------------------------
-            if(ret == GET_REQUEST){
+            else if(ret == GET_REQUEST){
+                m_ts_parsed = now_us();
                 return do_request();
             }
             line_status = LINE_OPEN;//从状态机状态转为允许继续读取数据
@@ -474,9 +778,24 @@ http_conn::HTTP_CODE http_conn::process_read()
 
 //解析完整的HTTP请求后，解析请求的URL进行处理并返回响应报文
 //m_real_file:完成处理后拼接的响应资源在服务端中的完整路径
-//m_string   :POST请求中在parse_content()中解析出的消息体（包含用户名和密码）
+//m_form_user/m_form_passwd:POST请求中在parse_content()中解析出的用户名和密码
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    TRACE_SCOPE(T_DO_REQUEST, m_conn_id);
+    WS_PROBE3(request_parsed, m_conn_id, m_method, m_url);
+    if (OPTIONS == m_method)
+        return OPTIONS_REQUEST;
+
+    //管理端口只提供指标，业务端口不暴露指标
+    if (m_admin)
+    {
+        if (strcmp(m_url, "/metrics") == 0 && (GET == m_method || HEAD == m_method))
+            return chunked_response(new text_source(metrics::render), "text/plain; version=0.0.4");
+        if (strcmp(m_url, "/trace") == 0 && (GET == m_method || HEAD == m_method))
+            return chunked_response(new text_source(trace::dump), "application/json");
+        return BAD_REQUEST;
+    }
+
     //1. 将m_real_file初始化为项目的根目录（WebServer类中初始化过的root）
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
@@ -497,64 +816,72 @@ http_conn::HTTP_CODE http_conn::do_request()
         strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
         free(m_url_real);
 
-        //2.1 将用户名和密码提取出来
-        //存于报文的消息体中：user=akira&password=akira
-        char name[100], password[100];
-        //a. 通过识别连接符 & 确定用户名
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-        //b. 确定密码
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
+        //2.1 用户名和密码已在解析消息体时取出(user=...&password=...)
+        const char *name = m_form_user;
+        const char *password = m_form_passwd;
 
         //2.2 处理注册请求
         if (*(p + 1) == '3')
         {
-            //构造sql INSERT语句（插入）
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            //首先查看数据库中是否已有重复的用户名：map中查找
-            //没有重名的，进行增加数据
-            if (users.find(name) == users.end())
+            //配置了计算线程池时，口令哈希和写入都交给计算线程，完成后在主线程中生成响应
+            if (m_kdf_pool)
             {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    //注册成功，跳转到登录页面
-                    strcpy(m_url, "/log.html");
-                else
-                    //注册失败，跳转到错误页面
-                    strcpy(m_url, "/registerError.html");
+                auth_ctx *ctx = new auth_ctx(this, true, name, password);
+                if (m_kdf_pool->submit(register_work, auth_done, ctx))
+                    return PENDING_REQUEST;
+                delete ctx;
+                return SERVICE_UNAVAILABLE;
             }
+
+            //重名直接失败，并发注册同名用户只有一个能成功
+            int ret = register_user(this, m_conn_id, name, password_hash(password, m_kdf_iter));
+            //后端异步写入，完成后在register_done中生成响应
+            if (user_store::STORE_PENDING == ret)
+                return PENDING_REQUEST;
+            //等不到数据库连接，让客户端稍后重试
+            if (user_store::STORE_BUSY == ret)
+                return SERVICE_UNAVAILABLE;
+            if (user_store::STORE_OK == ret)
+                //注册成功，跳转到登录页面
+                strcpy(m_url, "/log.html");
             else
-                //注册失败，跳转到错误页面(用户名重复)
+                //注册失败，跳转到错误页面
                 strcpy(m_url, "/registerError.html");
         }
 
         //2.2 处理登录请求
-        //若浏览器端输入的用户名和密码在map表中可以查找到，返回1，否则返回0
+        //用户存在且口令校验通过则登录成功
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == password)
+            string stored;
+            if (!m_store->find(name, stored))
+                strcpy(m_url, "/logError.html");
+            //哈希校验耗时数毫秒，交给计算线程
+            else if (m_kdf_pool && password_is_hashed(stored))
+            {
+                auth_ctx *ctx = new auth_ctx(this, false, name, password);
+                ctx->stored = stored;
+                if (m_kdf_pool->submit(login_work, auth_done, ctx))
+                    return PENDING_REQUEST;
+                delete ctx;
+                return SERVICE_UNAVAILABLE;
+            }
+            else if (password_verify(password, stored))
                 strcpy(m_url, "/welcome.html");
             else
                 strcpy(m_url, "/logError.html");
         }
     }
 
+    return do_file_request();
+}
+
+//登录注册处理完毕后，m_url已经是最终要返回的页面
+http_conn::HTTP_CODE http_conn::do_file_request()
+{
+    int len = strlen(doc_root);
+    const char *p = strrchr(m_url, '/');
+
     //3. 处理跳转到注册界面的请求
     if (*(p + 1) == '0')
     {
@@ -620,6 +947,10 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
 
+    //HEAD只需要文件大小，不映射文件
+    if (HEAD == m_method)
+        return FILE_REQUEST;
+
     //通过mmap将资源文件映射到内存中，提高文件的访问速度
     int fd = open(m_real_file, O_RDONLY);
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
@@ -645,13 +976,19 @@ void http_conn::unmap()
 // Proactor模式下，主线程调用users[sockfd].write函数向客户端发送响应报文，不经过工作线程处理
 bool http_conn::write()
 {
+    TRACE_SCOPE(T_WRITE, m_conn_id);
     int temp = 0;
 
+    //分块响应由chunk_writer边生成边发送
+    if (m_chunk_out.active())
+        return write_chunked();
+
     //没有数据需要发送，将sockfd从epoll中注册写事件（EPOLLOUT）改为读事件（EPOLLIN）继续监听
     if (bytes_to_send == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         init();
+        if (!pipelined())
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return true;
     }
 
@@ -659,6 +996,7 @@ bool http_conn::write()
     while (1)
     {
         temp = writev(m_sockfd, m_iv, m_iv_count);//将多个缓冲区iovec的数据一次性写入（发送）I/O描述符（m_sockfd）
+        WS_PROBE2(write, m_conn_id, temp);
 
         //发送失败：eagain满了暂时不可用 or 其他情况（取消映射）
         if (temp < 0)
@@ -681,7 +1019,7 @@ bool http_conn::write()
         bytes_to_send -= temp;
 
         //第一个缓冲区m_write_buf已全部发送完
-        if (bytes_have_send >= m_iv[0].iov_len)
+        if ((size_t)bytes_have_send >= m_iv[0].iov_len) //bytes_have_send不会为负
         {
             m_iv[0].iov_len = 0;
             m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
@@ -698,23 +1036,79 @@ bool http_conn::write()
         if (bytes_to_send <= 0)
         {
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            request_done();
 
             //保持长连接，重新初始化http_conn类中的一些参数
-            if (m_linger)
+            //排空开始前生成的响应可能仍带keep-alive，发完也直接关闭
+            if (m_linger && !m_draining.load(std::memory_order_relaxed))
             {
                 init();
+                //流水线中的下一个请求已在缓冲区，由调用方接着处理，处理完再注册事件
+                if (!pipelined())
+                    modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
                 return true;
             }
             //短连接return false，在webserver类或者工作线程中结束write后会调用deal_timer中timer的cb_func函数关闭连接
             else
             {
+                modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
                 return false;
             }
         }
     }
 }
 
+//复制到写缓冲区是为了沿用write()的部分发送逻辑，只是一次memcpy，不再格式化
+void http_conn::shed()
+{
+    const string &response = shed_response();
+    m_linger = false;
+    m_status = 503;
+    m_ts_handled = now_us();
+    memcpy(m_write_buf, response.data(), response.size());
+    m_write_idx = response.size();
+    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_len = m_write_idx;
+    m_iv_count = 1;
+    bytes_to_send = m_write_idx;
+    bytes_have_send = 0;
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+}
+
+bool http_conn::write_chunked()
+{
+    chunk_writer::WRITE_RESULT ret = m_chunk_out.send(m_sockfd);
+    if (chunk_writer::WRITE_AGAIN == ret)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+        return true;
+    }
+    bytes_have_send = m_chunk_out.bytes_sent();
+    m_chunk_out.reset();
+    //响应头已经发出，内容生成失败或发送失败都只能关闭连接
+    if (chunk_writer::WRITE_ERROR == ret)
+        return false;
+
+    request_done();
+    if (m_linger && !m_draining.load(std::memory_order_relaxed))
+    {
+        init();
+        if (!pipelined())
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return true;
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+    return false;
+}
+
+http_conn::HTTP_CODE http_conn::chunked_response(chunk_source *src, const char *content_type)
+{
+    delete m_chunk_src;
+    m_chunk_src = src;
+    m_chunk_type = content_type;
+    return CHUNKED_REQUEST;
+}
+
 //更新m_write_idx指针和缓冲区m_write_buf中的内容
 bool http_conn::add_response(const char* format, ...)
 {
@@ -733,7 +1127,7 @@ bool http_conn::add_response(const char* format, ...)
               WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
  
     // 写入数据长度超过缓冲区剩余空间，则报错
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_dix)) {
+    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
         va_end(arg_list);
         return false;
     }
@@ -749,6 +1143,7 @@ bool http_conn::add_response(const char* format, ...)
 //添加 状态行
 bool http_conn::add_status_line(int status, const char* title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
  
 }
@@ -756,9 +1151,7 @@ bool http_conn::add_status_line(int status, const char* title)
 //添加消息报头，具体的添加文本长度、连接状态和空行
 bool http_conn::add_headers(int content_len)
 {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_blank_line();
 }
  
 // 添加 Content-Length，响应报文长度
@@ -786,9 +1179,11 @@ bool http_conn::add_blank_line()
     return add_response("%s", "\r\n");
 }
  
-//添加文本content
+//添加文本content，HEAD请求只发送响应头
 bool http_conn::add_content(const char* content)
 {
+    if (HEAD == m_method)
+        return true;
     return add_response("%s", content);
 }
 
@@ -814,6 +1209,16 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    //消息体过大，剩余部分不再读取，只能关闭连接
+    case ENTITY_TOO_LARGE:
+    {
+        m_linger = false;
+        add_status_line(413, error_413_title);
+        add_headers(strlen(error_413_form));
+        if (!add_content(error_413_form))
+            return false;
+        break;
+    }
     //资源没有访问权限，403
     case FORBIDDEN_REQUEST:
     {
@@ -823,6 +1228,50 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    //来源IP请求过快，429，关闭连接
+    case TOO_MANY_REQUESTS:
+    {
+        m_linger = false;
+        add_status_line(429, error_429_title);
+        add_response("Retry-After:%d\r\n", 1);
+        add_headers(strlen(error_429_form));
+        if (!add_content(error_429_form))
+            return false;
+        break;
+    }
+    //后端暂时不可用，503，提示客户端1秒后重试
+    case SERVICE_UNAVAILABLE:
+    {
+        add_status_line(503, error_503_title);
+        add_response("Retry-After:%d\r\n", 1);
+        add_headers(strlen(error_503_form));
+        if (!add_content(error_503_form))
+            return false;
+        break;
+    }
+    //动态内容，长度事先未知，分块发送
+    case CHUNKED_REQUEST:
+    {
+        add_status_line(200, ok_200_title);
+        add_response("Content-Type:%s\r\n", m_chunk_type);
+        add_response("Transfer-Encoding:chunked\r\n");
+        add_linger();
+        if (!add_blank_line())
+            return false;
+        if (HEAD == m_method)
+            break;
+        m_chunk_out.start(m_write_buf, m_write_idx, m_chunk_src);
+        m_chunk_src = NULL;
+        return true;
+    }
+    //支持的方法，没有消息体
+    case OPTIONS_REQUEST:
+    {
+        add_status_line(200, ok_200_title);
+        add_response("Allow:%s\r\n", "GET, HEAD, POST, OPTIONS");
+        add_headers(0);
+        break;
+    }
     //文件存在，200
     case FILE_REQUEST:
     {
@@ -830,6 +1279,9 @@ bool http_conn::process_write(HTTP_CODE ret)
         if (m_file_stat.st_size != 0)
         {
             add_headers(m_file_stat.st_size);
+            //HEAD与GET的响应头相同，只是不发送文件
+            if (HEAD == m_method)
+                break;
             //第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
@@ -861,16 +1313,160 @@ bool http_conn::process_write(HTTP_CODE ret)
 
 void http_conn::process()
 {
+    TRACE_SCOPE(T_PROCESS, m_conn_id);
     HTTP_CODE read_ret = process_read();
     if (read_ret == NO_REQUEST)
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return;
     }
-    bool write_ret = process_write(read_ret);
+    //异步处理中，连接保持EPOLLONESHOT未注册状态，由完成回调生成响应
+    if (read_ret == PENDING_REQUEST)
+        return;
+    respond(read_ret);
+}
+
+void http_conn::respond(HTTP_CODE ret)
+{
+    m_ts_handled = now_us();
+    WS_PROBE2(request_handled, m_conn_id, ret);
+    //达到单连接请求数上限，本次响应后关闭，客户端会另建连接，长连接占用的资源得以轮换
+    ++m_requests;
+    if (m_max_requests > 0 && m_requests >= m_max_requests)
+        m_linger = false;
+    //服务器排空时告知客户端不再复用本连接
+    if (m_draining.load(std::memory_order_relaxed))
+        m_linger = false;
+    bool write_ret = process_write(ret);
     if (!write_ret)
     {
-        close_conn();
+        //respond可能在工作线程中执行，这里只shutdown，fd留给主线程收到EPOLLHUP后经定时器关闭
+        shutdown(m_sockfd, SHUT_RDWR);
     }
     modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
 }
+
+void http_conn::register_done(void *arg, int result)
+{
+    register_ctx *ctx = (register_ctx *)arg;
+
+    //等待期间连接可能已超时关闭甚至被新连接复用，此时直接丢弃结果
+    http_conn *conn = ctx->conn;
+    if (conn->alive(ctx->conn_id))
+    {
+        if (user_store::STORE_BUSY == result)
+            conn->resume(NULL);
+        else
+            conn->resume(user_store::STORE_OK == result ? "/log.html" : "/registerError.html");
+    }
+    delete ctx;
+}
+
+//把用户写入存储，返回STORE_PENDING时由register_done完成响应
+//计算线程中调用时连接可能正被主线程复用，conn_id由调用方传入
+int http_conn::register_user(http_conn *conn, unsigned int conn_id, const char *name, const string &stored)
+{
+    if (stored.empty())
+        return user_store::STORE_ERROR;
+    register_ctx *ctx = new register_ctx;
+    ctx->conn = conn;
+    ctx->conn_id = conn_id;
+    int ret = m_store->add_user(name, stored.c_str(), register_done, ctx);
+    if (user_store::STORE_PENDING != ret)
+        delete ctx;
+    return ret;
+}
+
+//计算线程：生成口令哈希并写入存储
+//同步写库的后端会在计算线程中等待数据库，哈希本身仍不占用I/O工作线程
+void http_conn::register_work(void *arg)
+{
+    auth_ctx *ctx = (auth_ctx *)arg;
+    ctx->result = register_user(ctx->conn, ctx->conn_id, ctx->name.c_str(), password_hash(ctx->passwd.c_str(), m_kdf_iter));
+}
+
+//计算线程：校验口令
+void http_conn::login_work(void *arg)
+{
+    auth_ctx *ctx = (auth_ctx *)arg;
+    ctx->ok = password_verify(ctx->passwd.c_str(), ctx->stored);
+}
+
+//主线程：计算完成，生成响应
+void http_conn::auth_done(void *arg)
+{
+    auth_ctx *ctx = (auth_ctx *)arg;
+    http_conn *conn = ctx->conn;
+    //写入仍在进行时由register_done完成响应
+    bool pending = ctx->is_register && user_store::STORE_PENDING == ctx->result;
+    if (!pending && conn->alive(ctx->conn_id))
+    {
+        if (!ctx->is_register)
+            conn->resume(ctx->ok ? "/welcome.html" : "/logError.html");
+        else if (user_store::STORE_BUSY == ctx->result)
+            conn->resume(NULL);
+        else
+            conn->resume(user_store::STORE_OK == ctx->result ? "/log.html" : "/registerError.html");
+    }
+    delete ctx;
+}
+
+//读请求头的期限从第一个字节(新连接从accept)起固定不变，慢速发送请求头的连接无法靠每次发一个字节续期
+//读消息体和发送响应只要有进展就重新计时；响应发完、等待下一个请求时使用长连接空闲期限
+time_t http_conn::expire_at(time_t now)
+{
+    if (bytes_to_send > 0 || m_chunk_out.active())
+        return now + m_write_timeout;
+    if (CHECK_STATE_CONTENT == m_check_state)
+        return now + m_body_timeout;
+    if (m_read_idx > 0 || m_check_state != CHECK_STATE_REQUESTLINE)
+        return (m_ts_first_read ? m_ts_first_read : m_ts_accept) / 1000000 + m_header_timeout;
+    if (m_requests > 0)
+        return now + m_keepalive_timeout;
+    return m_ts_accept / 1000000 + m_header_timeout;
+}
+
+//异步处理完成后继续：url为NULL时返回503，否则返回url对应的页面
+void http_conn::resume(const char *url)
+{
+    if (NULL == url)
+    {
+        respond(SERVICE_UNAVAILABLE);
+        return;
+    }
+    strcpy(m_url, url);
+    respond(do_file_request());
+}
+
+//状态码分类计数和各阶段耗时，每项只是本线程指标槽上的一次加法
+void http_conn::request_done()
+{
+    long long now = now_us();
+    if (m_status >= 200 && m_status < 600)
+        metrics::inc((METRIC_COUNTER)(M_RESP_2XX + (m_status >= 300) + (m_status >= 400) + (m_status >= 500)));
+    metrics::inc(M_BYTES_SENT, bytes_have_send);
+    metrics::record(H_REQUEST, now - (m_ts_first_read ? m_ts_first_read : m_ts_accept));
+    if (m_ts_parsed && m_ts_handled)
+        metrics::record(H_HANDLE, m_ts_handled - m_ts_parsed);
+    WS_PROBE3(request_done, m_conn_id, m_status, now - (m_ts_first_read ? m_ts_first_read : m_ts_accept));
+    log_access();
+}
+
+//访问日志：方法 路径 状态码 发送字节数 是否长连接，以及各阶段相对accept的耗时
+//accept为墙上时间，其余为相对偏移，便于定位尾延迟出现在哪个阶段
+void http_conn::log_access()
+{
+    if (m_access_sample <= 0)
+        return;
+    if (access_seq.fetch_add(1, std::memory_order_relaxed) % m_access_sample != 0)
+        return;
+
+    long long written = now_us();
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+
+    LOG_ACCESS("%s \"%s %s\" %d %d keep-alive=%d accept=%lld first_read=+%lld parsed=+%lld handled=+%lld written=+%lld",
+               ip, method_name[m_method], m_req_path, m_status, bytes_have_send, m_linger ? 1 : 0,
+               m_ts_accept, m_ts_first_read - m_ts_accept, m_ts_parsed - m_ts_accept,
+               m_ts_handled - m_ts_accept, written - m_ts_accept);
+}
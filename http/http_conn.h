@@ -20,11 +20,20 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <atomic>
 
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "form_parser.h"
+#include "chunked_decoder.h"
+#include "chunk_writer.h"
+#include "rate_limiter.h"
+#include "../CGImysql/user_store.h"
+#include "../CGImysql/password.h"
+#include "../threadpool/compute_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
 
 class http_conn
 {
@@ -59,7 +68,13 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        PENDING_REQUEST,    //已交给异步组件处理，完成后再生成响应
+        SERVICE_UNAVAILABLE, //后端暂时不可用，返回503
+        ENTITY_TOO_LARGE,    //消息体超过上限，返回413
+        CHUNKED_REQUEST,     //动态内容，由chunk_source分块生成
+        OPTIONS_REQUEST,     //OPTIONS，只返回支持的方法
+        TOO_MANY_REQUESTS    //来源IP请求过快，返回429
     };
     enum LINE_STATUS   //从状态机
     {
@@ -68,12 +83,15 @@ public:
         LINE_OPEN
     };
 
+    friend struct http_conn_bench; //bench/micro_bench.cpp直接驱动解析函数
+
 public:
-    http_conn() {}
+    http_conn() : m_file_address(NULL), m_chunk_src(NULL), m_upload_fd(-1) {}
     ~http_conn() {}
 
 public:
     void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
+    //释放连接的fd、计数和资源，只由主线程经定时器回调(cb_func)调用，每个连接只关闭一次
     void close_conn(bool real_close = true);
 
     //各子线程通过process函数对任务进行处理，
@@ -86,14 +104,39 @@ public:
 
     bool write();
 
+    //过载时不处理请求，直接回复预先生成的503并在发送后关闭连接
+    void shed();
+
     sockaddr_in *get_address()
     {
         return &m_address;
     }
+    unsigned int get_conn_id()
+    {
+        return m_conn_id;
+    }
+    //按连接当前所处阶段(读请求头/读消息体/发送响应/长连接空闲)计算超时时刻
+    time_t expire_at(time_t now);
+    //异步回调发出时的连接仍然打开且没有被新连接复用
+    bool alive(unsigned int conn_id) const { return m_sockfd != -1 && m_conn_id == conn_id; }
+    //管理端口上的连接，只提供/metrics
+    void set_admin(bool admin) { m_admin = admin; }
+    //上一个响应发完后，流水线中的下一个请求已经在读缓冲区中，不会再触发读事件，需直接交给process
+    bool pipelined() const
+    {
+        return m_read_idx > 0 && 0 == bytes_to_send && !m_chunk_out.active() && CHECK_STATE_REQUESTLINE == m_check_state;
+    }
+    //长连接已处理完上一个请求、在等下一个请求，排空时可以直接关闭
+    //下一个请求可能已到达套接字缓冲区、还没被读出，此时关闭客户端会把它当作失败，留给正常流程回Connection: close
+    bool idle() const
+    {
+        char c;
+        return m_requests > 0 && 0 == m_read_idx && 0 == bytes_to_send && !m_chunk_out.active() &&
+               CHECK_STATE_REQUESTLINE == m_check_state && recv(m_sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0;
+    }
 
-    void initmysql_result(connection_pool *connPool);
     int timer_flag;
-    int improv;
+    std::atomic<int> improv; //reactor模式下工作线程处理完毕的标志，release发布，主线程acquire读取
 
 
 private:
@@ -110,7 +153,30 @@ private:
     HTTP_CODE parse_headers(char *text);
 
     HTTP_CODE parse_content(char *text);
+    //表单字段回调，取出登录注册的用户名和密码
+    static bool on_form_field(void *arg, const form_part &part);
+    //上传文件的一段，写入上传目录下的临时文件，最后一段写完后改为正式文件名
+    bool upload_part(const form_part &part);
+    //删除未写完的上传临时文件
+    void abort_upload();
     HTTP_CODE do_request();
+    //根据m_url定位资源文件并映射到内存
+    HTTP_CODE do_file_request();
+    //处理函数生成动态内容时调用，之后返回CHUNKED_REQUEST，src由连接负责释放
+    HTTP_CODE chunked_response(chunk_source *src, const char *content_type);
+    //分块响应的发送
+    bool write_chunked();
+    //生成响应并注册写事件
+    void respond(HTTP_CODE ret);
+    //异步处理完成后生成响应，url为NULL时返回503
+    void resume(const char *url);
+    //存储后端异步注册完成回调，在主线程中执行
+    static void register_done(void *arg, int result);
+    static int register_user(http_conn *conn, unsigned int conn_id, const char *name, const string &stored);
+    //计算线程中的口令哈希/校验，以及完成后在主线程中的回调
+    static void register_work(void *arg);
+    static void login_work(void *arg);
+    static void auth_done(void *arg);
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
     void unmap();
@@ -122,11 +188,27 @@ private:
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    //响应发送完毕：记录指标，按采样率输出访问日志
+    void request_done();
+    //请求发送完毕后按采样率输出一条访问日志
+    void log_access();
 
 public:
     static int m_epollfd;
-    static int m_user_count;
-    MYSQL *mysql;
+    static std::atomic<int> m_user_count; //工作线程抓取指标时也会读取
+    static int m_access_sample; //访问日志采样，每N个请求记录一条，0为关闭
+    static user_store *m_store;    //用户凭据存储
+    static compute_pool *m_kdf_pool; //口令哈希计算线程池，为NULL时在工作线程中计算
+    static int m_kdf_iter;         //新口令的PBKDF2迭代次数，0为明文
+    static long long m_max_body;   //消息体上限(字节)
+    static string m_upload_dir;    //multipart上传文件的保存目录，为空时丢弃
+    static int m_header_timeout;    //读请求头的总时长(秒)，从收到第一个字节起算，不随数据到达延长
+    static int m_body_timeout;      //读消息体时两次收到数据的最长间隔(秒)
+    static int m_write_timeout;     //发送响应时两次可写的最长间隔(秒)
+    static int m_keepalive_timeout; //长连接等待下一个请求的最长空闲(秒)
+    static int m_max_requests;      //每个连接最多处理的请求数，达到后回复Connection: close，0为不限
+    static rate_limiter *m_limiter; //按来源IP限流，为NULL时不限
+    static std::atomic<bool> m_draining; //服务器正在排空，之后的响应都带Connection: close，发完即关闭
     int m_state;  //读为0, 写为1
 
 private:
@@ -145,20 +227,45 @@ private:
     char *m_version;
     char *m_host;
     long m_content_length;
+    bool m_chunked;               //Transfer-Encoding: chunked
+    chunked_decoder m_chunk;
+    bool m_expect_continue;       //Expect: 100-continue
     bool m_linger;
     char *m_file_address;
     struct stat m_file_stat;
     struct iovec m_iv[2];
     int m_iv_count;
+    chunk_source *m_chunk_src;   //待发送的动态内容
+    const char *m_chunk_type;
+    chunk_writer m_chunk_out;    //正在发送的分块响应
     int cgi;        //是否启用POST
-    char *m_string; //存储请求头数据
+    char *m_content_type;
+    long long m_body_read; //已送入表单解析器的消息体字节数(chunked时为解码后的字节数)
+    form_parser m_form; //消息体边到达边解析，解析过的部分随即从读缓冲区回收
+    char m_form_user[100];
+    char m_form_passwd[100];
+    bool m_form_overflow; //字段超长
+    int m_upload_fd;      //正在写入的上传临时文件
+    char m_upload_tmp[FILENAME_LEN];
+    long long m_upload_size;
+    bool m_upload_error;  //上传文件写入失败，返回500
     int bytes_to_send;
     int bytes_have_send;
     char *doc_root;
 
-    map<string, string> m_users;
     int m_TRIGMode;
     int m_close_log;
+    unsigned int m_conn_id; //每次accept分配新编号，异步回调据此判断连接是否已被复用
+    int m_requests;         //本连接已处理的请求数
+    bool m_admin;           //管理端口上的连接
+
+    //访问日志相关，时间戳单位为微秒
+    char m_req_path[FILENAME_LEN]; //原始请求路径，do_request会改写m_url
+    int m_status;                  //响应状态码
+    long long m_ts_accept;         //连接建立
+    long long m_ts_first_read;     //读到本次请求的第一个字节
+    long long m_ts_parsed;         //请求解析完成
+    long long m_ts_handled;        //do_request完成
 
     char sql_user[100];
     char sql_passwd[100];
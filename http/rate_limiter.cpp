@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rate_limiter.h"
+
+rate_limiter::rate_limiter() : m_shards(NULL), m_rejected_conns(0), m_rejected_reqs(0)
+{
+    memset(&m_conf, 0, sizeof(m_conf));
+}
+
+rate_limiter::~rate_limiter()
+{
+    if (!m_shards)
+        return;
+    for (int i = 0; i < (1 << SHARD_BITS); ++i)
+    {
+        free(m_shards[i].buckets);
+        free(m_shards[i].entries);
+    }
+    delete[] m_shards;
+}
+
+bool rate_limiter::init(const rate_limit_conf &conf)
+{
+    if (conf.table_size <= 0)
+        return false;
+    m_conf = conf;
+    if (m_conf.req_burst < 1)
+        m_conf.req_burst = 1;
+    if (m_conf.conn_burst < 1)
+        m_conf.conn_burst = 1;
+
+    int shards = 1 << SHARD_BITS;
+    uint32_t capacity = (conf.table_size + shards - 1) / shards;
+    //哈希桶数取不小于容量的2的幂，链平均长度不超过1
+    uint32_t buckets = 1;
+    while (buckets < capacity)
+        buckets <<= 1;
+
+    m_shards = new shard[shards];
+    for (int i = 0; i < shards; ++i)
+    {
+        shard &s = m_shards[i];
+        s.buckets = (uint32_t *)malloc(buckets * sizeof(uint32_t));
+        s.entries = (ip_entry *)malloc(capacity * sizeof(ip_entry));
+        if (!s.buckets || !s.entries)
+            return false;
+        memset(s.buckets, 0xff, buckets * sizeof(uint32_t));
+        s.mask = buckets - 1;
+        s.used = 0;
+        s.capacity = capacity;
+        s.lru_head = NIL;
+        s.lru_tail = NIL;
+    }
+    return true;
+}
+
+//murmur3的收尾混合，高位选分片，低位选哈希桶
+uint32_t rate_limiter::hash(uint32_t ip)
+{
+    ip ^= ip >> 16;
+    ip *= 0x85ebca6b;
+    ip ^= ip >> 13;
+    ip *= 0xc2b2ae35;
+    ip ^= ip >> 16;
+    return ip;
+}
+
+//粗粒度单调时钟，不进内核，精度几毫秒对限流足够
+uint32_t rate_limiter::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+void rate_limiter::lru_unlink(shard &s, uint32_t idx)
+{
+    ip_entry &e = s.entries[idx];
+    if (e.lru_prev != NIL)
+        s.entries[e.lru_prev].lru_next = e.lru_next;
+    else
+        s.lru_head = e.lru_next;
+    if (e.lru_next != NIL)
+        s.entries[e.lru_next].lru_prev = e.lru_prev;
+    else
+        s.lru_tail = e.lru_prev;
+}
+
+void rate_limiter::lru_push_front(shard &s, uint32_t idx)
+{
+    ip_entry &e = s.entries[idx];
+    e.lru_prev = NIL;
+    e.lru_next = s.lru_head;
+    if (s.lru_head != NIL)
+        s.entries[s.lru_head].lru_prev = idx;
+    s.lru_head = idx;
+    if (NIL == s.lru_tail)
+        s.lru_tail = idx;
+}
+
+rate_limiter::ip_entry *rate_limiter::lookup(shard &s, uint32_t ip, uint32_t h)
+{
+    uint32_t *bucket = &s.buckets[h & s.mask];
+    for (uint32_t idx = *bucket; idx != NIL; idx = s.entries[idx].next)
+    {
+        if (s.entries[idx].ip == ip)
+        {
+            if (s.lru_head != idx)
+            {
+                lru_unlink(s, idx);
+                lru_push_front(s, idx);
+            }
+            return &s.entries[idx];
+        }
+    }
+
+    uint32_t idx;
+    if (s.used < s.capacity)
+        idx = s.used++;
+    else
+    {
+        //淘汰最久未访问的IP：从LRU和它所在的哈希链上摘下，表项原地复用
+        idx = s.lru_tail;
+        lru_unlink(s, idx);
+        uint32_t *p = &s.buckets[hash(s.entries[idx].ip) & s.mask];
+        while (*p != idx)
+            p = &s.entries[*p].next;
+        *p = s.entries[idx].next;
+    }
+
+    ip_entry &e = s.entries[idx];
+    e.ip = ip;
+    e.next = *bucket;
+    *bucket = idx;
+    e.last_ms = now_ms();
+    e.req_tokens = m_conf.req_burst;
+    e.conn_tokens = m_conf.conn_burst;
+    e.conns = 0;
+    lru_push_front(s, idx);
+    return &e;
+}
+
+void rate_limiter::refill(ip_entry &e, uint32_t now)
+{
+    //无符号相减，时钟回绕也能得到正确的间隔
+    uint32_t elapsed = now - e.last_ms;
+    if (0 == elapsed)
+        return;
+    e.last_ms = now;
+    float sec = elapsed / 1000.0f;
+    e.req_tokens += sec * m_conf.req_rate;
+    if (e.req_tokens > m_conf.req_burst)
+        e.req_tokens = m_conf.req_burst;
+    e.conn_tokens += sec * m_conf.conn_rate;
+    if (e.conn_tokens > m_conf.conn_burst)
+        e.conn_tokens = m_conf.conn_burst;
+}
+
+bool rate_limiter::on_accept(uint32_t ip)
+{
+    if (m_conf.conn_rate <= 0 && m_conf.max_conns <= 0)
+        return true;
+    uint32_t h = hash(ip);
+    shard &s = m_shards[h >> (32 - SHARD_BITS)];
+    s.lock.lock();
+    ip_entry *e = lookup(s, ip, h);
+    refill(*e, now_ms());
+    bool ok = (m_conf.conn_rate <= 0 || e->conn_tokens >= 1) &&
+              (m_conf.max_conns <= 0 || e->conns < (uint32_t)m_conf.max_conns);
+    if (ok)
+    {
+        if (m_conf.conn_rate > 0)
+            e->conn_tokens -= 1;
+        ++e->conns;
+    }
+    s.lock.unlock();
+    if (!ok)
+        m_rejected_conns.fetch_add(1, std::memory_order_relaxed);
+    return ok;
+}
+
+void rate_limiter::on_close(uint32_t ip)
+{
+    if (m_conf.conn_rate <= 0 && m_conf.max_conns <= 0)
+        return;
+    uint32_t h = hash(ip);
+    shard &s = m_shards[h >> (32 - SHARD_BITS)];
+    s.lock.lock();
+    //只在表里查，不新建；已被淘汰的IP不用处理
+    for (uint32_t idx = s.buckets[h & s.mask]; idx != NIL; idx = s.entries[idx].next)
+    {
+        if (s.entries[idx].ip == ip)
+        {
+            if (s.entries[idx].conns > 0)
+                --s.entries[idx].conns;
+            break;
+        }
+    }
+    s.lock.unlock();
+}
+
+bool rate_limiter::on_request(uint32_t ip)
+{
+    if (m_conf.req_rate <= 0)
+        return true;
+    uint32_t h = hash(ip);
+    shard &s = m_shards[h >> (32 - SHARD_BITS)];
+    s.lock.lock();
+    ip_entry *e = lookup(s, ip, h);
+    refill(*e, now_ms());
+    bool ok = e->req_tokens >= 1;
+    if (ok)
+        e->req_tokens -= 1;
+    s.lock.unlock();
+    if (!ok)
+        m_rejected_reqs.fetch_add(1, std::memory_order_relaxed);
+    return ok;
+}
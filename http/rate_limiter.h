@@ -0,0 +1,86 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include "../lock/locker.h"
+
+//各项为0表示不限制
+struct rate_limit_conf
+{
+    double req_rate;   //每个IP每秒请求数
+    int req_burst;     //请求突发上限
+    double conn_rate;  //每个IP每秒新建连接数
+    int conn_burst;    //建连突发上限
+    int max_conns;     //每个IP同时打开的连接数
+    int table_size;    //最多跟踪的IP数，超过后淘汰最久未访问的
+};
+
+/*************************************************************
+*按客户端IP的令牌桶限流
+*哈希表按IP分片，每片一把锁，片内用数组存表项、下标串起哈希链和LRU链，
+*内存在初始化时一次分配(每个IP 32字节)，满了淘汰最久未访问的IP，每次检查O(1)
+*被淘汰的IP重新出现时按满桶计算，并发连接数也随之清零，因此上限是近似的
+**************************************************************/
+class rate_limiter
+{
+public:
+    rate_limiter();
+    ~rate_limiter();
+
+    bool init(const rate_limit_conf &conf);
+
+    //新连接：建连速率和并发连接数都未超限时计入一个连接并返回true
+    bool on_accept(uint32_t ip);
+    //连接关闭，与on_accept成功的调用一一对应
+    void on_close(uint32_t ip);
+    //新请求：请求速率未超限时返回true
+    bool on_request(uint32_t ip);
+
+    unsigned long long rejected_conns() const { return m_rejected_conns.load(std::memory_order_relaxed); }
+    unsigned long long rejected_reqs() const { return m_rejected_reqs.load(std::memory_order_relaxed); }
+
+private:
+    static const int SHARD_BITS = 6;
+    static const uint32_t NIL = 0xffffffff;
+
+    struct ip_entry
+    {
+        uint32_t ip;
+        uint32_t next;     //同一哈希桶的下一项
+        uint32_t lru_prev;
+        uint32_t lru_next;
+        uint32_t last_ms;  //上次补充令牌的时间
+        float req_tokens;
+        float conn_tokens;
+        uint32_t conns;    //当前打开的连接数
+    };
+
+    struct shard
+    {
+        locker lock;
+        uint32_t *buckets;
+        ip_entry *entries;
+        uint32_t mask;
+        uint32_t used;
+        uint32_t capacity;
+        uint32_t lru_head; //最近访问
+        uint32_t lru_tail; //最久未访问，满时淘汰
+    };
+
+    static uint32_t hash(uint32_t ip);
+    static uint32_t now_ms();
+    //找到ip对应的表项并移到LRU头部，没有则新建(必要时淘汰)，调用时持有分片锁
+    ip_entry *lookup(shard &s, uint32_t ip, uint32_t h);
+    void lru_unlink(shard &s, uint32_t idx);
+    void lru_push_front(shard &s, uint32_t idx);
+    //按经过的时间补充令牌
+    void refill(ip_entry &e, uint32_t now);
+
+    rate_limit_conf m_conf;
+    shard *m_shards;
+    std::atomic<unsigned long long> m_rejected_conns;
+    std::atomic<unsigned long long> m_rejected_reqs;
+};
+
+#endif
@@ -29,6 +29,7 @@ public:
         m_size = 0;
         m_front = -1;
         m_back = -1;
+        m_closed = false;
     }
 
     void clear()
@@ -128,7 +129,7 @@ public:
     {
 
         m_mutex.lock();
-        if (m_size >= m_max_size)
+        if (m_size >= m_max_size || m_closed)
         {
 
             m_cond.broadcast();
@@ -152,7 +153,12 @@ public:
         m_mutex.lock();
         while (m_size <= 0)
         {
-            
+            //已关闭且取空，消费者线程退出
+            if (m_closed)
+            {
+                m_mutex.unlock();
+                return false;
+            }
             if (!m_cond.wait(m_mutex.get()))
             {
                 m_mutex.unlock();
@@ -198,6 +204,15 @@ public:
         return true;
     }
 
+    //关闭队列：之后push失败，pop取完剩余元素后返回false，用于让消费者线程退出
+    void close()
+    {
+        m_mutex.lock();
+        m_closed = true;
+        m_cond.broadcast();
+        m_mutex.unlock();
+    }
+
 private:
     locker m_mutex;
     cond m_cond;
@@ -207,6 +222,7 @@ private:
     int m_max_size;
     int m_front;
     int m_back;
+    bool m_closed;
 };
 
 #endif
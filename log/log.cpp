@@ -1,15 +1,30 @@
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <stdarg.h>
+#include <zlib.h>
+#include <vector>
+#include <algorithm>
 #include "log.h"
 #include <pthread.h>
 using namespace std;
 
+//距离零点不足该秒数时预打开次日的日志文件
+static const int PREOPEN_SECONDS = 60;
+
 Log::Log()
 {
     m_count = 0;
     m_is_async = false;
+    m_fp = NULL;
+    m_next_fp = NULL;
+    m_preopen_pending = false;
+    m_task_queue = NULL;
 }
 
 Log::~Log()
@@ -21,7 +36,8 @@ Log::~Log()
 }
 //根据同步和异步的不同初始化日志（异步需要初始化阻塞队列、初始化互斥锁、初始化阻塞队列）
 //实现参数初始化、根据当前时间创建or打开日志文件
-bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size)
+bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size,
+               int compress, int max_files, long long max_bytes)
 {
     //1. 如果max_queue_size>0，则表示选择的方式是异步写日志，
     //需要初始化阻塞队列、初始化互斥锁、初始化阻塞队列
@@ -31,8 +47,7 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
 
         //异步写日志需要创建单独的写线程，
         //回调函数为flush_log_thread实现pop阻塞队列中的日志消息并写入日志文件
-        pthread_t tid;
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+        pthread_create(&m_write_tid, NULL, flush_log_thread, NULL);
     }
 
     //2. 初始化参数，包括缓冲区大小、日志文件行数上限、关闭日志、日志文件名
@@ -41,6 +56,14 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
     m_buf = new char[m_log_buf_size];
     memset(m_buf, '\0', m_log_buf_size);
     m_split_lines = split_lines;
+    m_preopen_line = split_lines - split_lines / 10;
+    m_compress = compress;
+    m_max_files = max_files;
+    m_max_bytes = max_bytes;
+
+    //切分出的旧文件的关闭、压缩与清理交给低优先级的维护线程
+    m_task_queue = new block_queue<log_task>(64);
+    pthread_create(&m_rotate_tid, NULL, rotate_log_thread, NULL);
 
     //3. 根据当前时间创建or打开日志文件
     //3.1 解析文件路径
@@ -55,6 +78,8 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
     if(p==NULL){
         //a. 未传入路径，直接将 时间+文件名 拼接
         //eg文件名: ServerLog
+        dir_name[0] = '\0';
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
         snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year+1900, 
         my_tm.tm_mon+1, my_tm.tm_mday, file_name);
     }else
@@ -67,14 +92,335 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
         my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
     }
     m_today = my_tm.tm_mday;//记录当前日期
+    update_next_midnight(t);
     //3.2 打开or创建文件
     m_fp = fopen(log_full_name, "a");
     if(m_fp == NULL){//打开失败
         return false;
     }
+    snprintf(m_cur_name, sizeof(m_cur_name), "%s", log_full_name);
     return true;
 }
 
+void Log::update_next_midnight(time_t now)
+{
+    struct tm my_tm;
+    localtime_r(&now, &my_tm);
+    my_tm.tm_mday += 1;
+    my_tm.tm_hour = 0;
+    my_tm.tm_min = 0;
+    my_tm.tm_sec = 0;
+    my_tm.tm_isdst = -1;
+    m_next_midnight = mktime(&my_tm);
+}
+
+bool Log::make_log_name(char *buf, const struct tm &day, long long part)
+{
+    int n;
+    if (part > 0)
+        n = snprintf(buf, 256, "%s%d_%02d_%02d_%s.%lld", dir_name, day.tm_year + 1900, day.tm_mon + 1,
+                     day.tm_mday, log_name, part);
+    else
+        n = snprintf(buf, 256, "%s%d_%02d_%02d_%s", dir_name, day.tm_year + 1900, day.tm_mon + 1,
+                     day.tm_mday, log_name);
+    //路径过长被截断时不切换，避免写到截断后的另一个文件名
+    if (n < 0 || n >= 256)
+    {
+        buf[0] = '\0';
+        return false;
+    }
+    return true;
+}
+
+//同步模式在write_log中调用，异步模式在写线程中调用
+//这里只做文件指针的切换：下一个文件通常已由维护线程预先打开，
+//旧文件的fflush/fclose也交给维护线程，不再阻塞持有m_mutex的其它写日志线程
+void Log::check_rotate(time_t now)
+{
+    m_count++;//行数+1
+    bool new_day = now >= m_next_midnight;
+    if (!new_day && m_count % m_split_lines != 0)
+    {
+        //临近切分点或零点，请求维护线程预先打开下一个文件
+        if (!m_preopen_pending)
+        {
+            char next_log[256] = {0};
+            if (now >= m_next_midnight - PREOPEN_SECONDS)
+            {
+                struct tm next_tm;
+                localtime_r(&m_next_midnight, &next_tm);
+                make_log_name(next_log, next_tm, 0);
+            }
+            else if (m_count % m_split_lines >= m_preopen_line)
+            {
+                struct tm my_tm;
+                localtime_r(&now, &my_tm);
+                make_log_name(next_log, my_tm, m_count / m_split_lines + 1);
+            }
+            if (next_log[0] != '\0')
+            {
+                m_preopen_pending = true;
+                post_task(TASK_PREOPEN, NULL, next_log);
+            }
+        }
+        return;
+    }
+
+    char new_log[256] = {0};
+    struct tm my_tm;
+    localtime_r(&now, &my_tm);
+    //a. 到第二天了，需要创建新的日志文件
+    if (new_day)
+    {
+        if (!make_log_name(new_log, my_tm, 0))
+            return;
+        m_today = my_tm.tm_mday;
+        m_count = 0;
+        update_next_midnight(now);
+    }
+    //b. 行数达到最大行数，需要创建新的日志文件
+    else
+    {
+        if (!make_log_name(new_log, my_tm, m_count / m_split_lines))
+            return;
+    }
+
+    FILE *fp = NULL;
+    if (m_next_fp && strcmp(m_next_name, new_log) == 0)
+    {
+        fp = m_next_fp;
+    }
+    else
+    {
+        //预打开的文件没赶上或者不是想要的文件，只能在当前线程打开
+        if (m_next_fp)
+            post_task(TASK_DISCARD, m_next_fp, m_next_name);
+        fp = fopen(new_log, "a");
+    }
+    m_next_fp = NULL;
+    m_next_name[0] = '\0';
+    m_preopen_pending = false;
+
+    //新文件打开失败则继续写旧文件
+    if (fp == NULL)
+        return;
+    //先切到新文件，旧文件交给维护线程时m_cur_name已是新文件，清理不会删到它
+    FILE *old_fp = m_fp;
+    string old_name = m_cur_name;
+    m_fp = fp;
+    snprintf(m_cur_name, sizeof(m_cur_name), "%s", new_log);
+    post_task(TASK_CLOSE, old_fp, old_name);
+}
+
+void Log::async_rotate_log()
+{
+    //压缩和清理都是后台工作，降低本线程的调度优先级
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    log_task task;
+    while (m_task_queue->pop(task))
+    {
+        handle_task(task);
+    }
+}
+
+//将path压缩为path.gz，成功后删除原文件
+static bool gzip_file(const string &path)
+{
+    string gz_path = path + ".gz";
+    FILE *in = fopen(path.c_str(), "rb");
+    if (in == NULL)
+        return false;
+    gzFile out = gzopen(gz_path.c_str(), "wb6");
+    if (out == NULL)
+    {
+        fclose(in);
+        return false;
+    }
+
+    char buf[64 * 1024];
+    size_t n;
+    bool ok = true;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        if (gzwrite(out, buf, n) != (int)n)
+        {
+            ok = false;
+            break;
+        }
+    }
+    fclose(in);
+    if (gzclose(out) != Z_OK)
+        ok = false;
+
+    if (ok)
+        unlink(path.c_str());
+    else
+        unlink(gz_path.c_str());
+    return ok;
+}
+
+//关闭没用上的预打开文件，文件为空则删除
+static void discard_file(FILE *fp, const string &path)
+{
+    fclose(fp);
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && st.st_size == 0)
+        unlink(path.c_str());
+}
+
+void Log::handle_task(log_task &task)
+{
+    switch (task.type)
+    {
+    case TASK_PREOPEN:
+    {
+        FILE *fp = fopen(task.path.c_str(), "a");
+        m_mutex.lock();
+        //切换可能已经先于预打开完成，此时path就是正在写的文件，不能删除
+        bool in_use = task.path == m_cur_name;
+        if (fp && m_preopen_pending && m_next_fp == NULL && !in_use)
+        {
+            m_next_fp = fp;
+            snprintf(m_next_name, sizeof(m_next_name), "%s", task.path.c_str());
+            fp = NULL;
+        }
+        else if (fp == NULL)
+        {
+            //打开失败，允许切换时再次尝试
+            m_preopen_pending = false;
+        }
+        m_mutex.unlock();
+        if (fp && in_use)
+            fclose(fp);
+        else if (fp)
+            discard_file(fp, task.path);
+        break;
+    }
+    case TASK_CLOSE:
+    {
+        fflush(task.fp);
+        fclose(task.fp);
+        if (m_compress)
+            gzip_file(task.path);
+        apply_retention();
+        break;
+    }
+    case TASK_DISCARD:
+    {
+        discard_file(task.fp, task.path);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+struct log_file_info
+{
+    string day;     //文件名中的日期
+    long long part; //切分序号
+    long long size;
+    string path;
+};
+
+//按文件名中的日期和切分序号排序，压缩会改写mtime，不能作为新旧依据
+static bool older_first(const log_file_info &a, const log_file_info &b)
+{
+    if (a.day != b.day)
+        return a.day < b.day;
+    return a.part < b.part;
+}
+
+void Log::apply_retention()
+{
+    if (m_max_files <= 0 && m_max_bytes <= 0)
+        return;
+
+    char cur_name[256], next_name[256];
+    m_mutex.lock();
+    snprintf(cur_name, sizeof(cur_name), "%s", m_cur_name);
+    snprintf(next_name, sizeof(next_name), "%s", m_next_name);
+    m_mutex.unlock();
+    const char *dir = dir_name[0] ? dir_name : "./";
+    DIR *dp = opendir(dir);
+    if (dp == NULL)
+        return;
+
+    //日志文件名形如 2024_03_11_ServerLog[.N][.gz]
+    vector<log_file_info> files;
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL)
+    {
+        const char *name = entry->d_name;
+        const char *found = strstr(name, log_name);
+        if (found == NULL || found - name != 11 || name[10] != '_')
+            continue;
+
+        log_file_info info;
+        info.day.assign(name, 10);
+        const char *tail = found + strlen(log_name);
+        info.part = ('.' == tail[0]) ? atoll(tail + 1) : 0;
+        info.path = string(dir_name) + name;
+        if (info.path == cur_name || info.path == next_name)
+            continue;
+        struct stat st;
+        if (stat(info.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        info.size = st.st_size;
+        files.push_back(info);
+    }
+    closedir(dp);
+
+    sort(files.begin(), files.end(), older_first);
+    long long total = 0;
+    for (size_t i = 0; i < files.size(); ++i)
+        total += files[i].size;
+
+    size_t count = files.size();
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        bool over_count = m_max_files > 0 && count > (size_t)m_max_files;
+        bool over_bytes = m_max_bytes > 0 && total > m_max_bytes;
+        if (!over_count && !over_bytes)
+            break;
+        if (unlink(files[i].path.c_str()) == 0)
+        {
+            --count;
+            total -= files[i].size;
+        }
+    }
+}
+
+void Log::post_task(int type, FILE *fp, const string &path)
+{
+    log_task task;
+    task.type = type;
+    task.fp = fp;
+    task.path = path;
+    if (m_task_queue->push(task))
+        return;
+
+    //队列满或已停止时在当前线程处理，调用方持有m_mutex，只做必须的关闭，不再预打开
+    //压缩和清理要读整个文件、扫描目录，不能在写日志的路径上做：这个文件保持未压缩，
+    //下次维护线程清理时按个数和大小一并计入
+    switch (type)
+    {
+    case TASK_PREOPEN:
+        m_preopen_pending = false;
+        break;
+    case TASK_CLOSE:
+        fflush(fp);
+        fclose(fp);
+        break;
+    case TASK_DISCARD:
+        discard_file(fp, path);
+        break;
+    default:
+        break;
+    }
+}
+
 //write_log由define宏定义的宏函数自动调用的
 //生产者向阻塞队列中写入日志消息，解析日志消息类型，并将缓冲区强制刷新到日志文件
 //传入可变参数列表
@@ -95,6 +441,9 @@ void Log::write_log(int level, const char *format, ...)
     case 3:
         strcpy(s, "[erro]:");
         break;
+    case 4:
+        strcpy(s, "[access]:");
+        break;
     default:
         strcpy(s, "[info]:");
         break;
@@ -103,40 +452,18 @@ void Log::write_log(int level, const char *format, ...)
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
     time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
     //1. 写入日志前的处理：更新日志文件名
     //1.1 判断当前行数是否达到最大行数，或者是否到了第二天
-    m_mutex.lock();
-    m_count++;//行数+1
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
+    //异步模式下由写线程负责计数和切换文件
+    if (!m_is_async)
     {
-        
-        char new_log[256] = {0};
-        fflush(m_fp);//先强制将缓冲区的内容写入文件，避免日志丢失
-        fclose(m_fp);
-        char tail[16] = {0};//时间戳
-       
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-
-        //a. 到第二天了，需要创建新的日志文件
-        if (m_today != my_tm.tm_mday)
-        {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        }
-        //b. 行数达到最大行数，需要创建新的日志文件
-        else
-        {
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
-        }
-
-        //创建打开新的日志文件
-        m_fp = fopen(new_log, "a");
+        m_mutex.lock();
+        check_rotate(t);
+        m_mutex.unlock();
     }
-    m_mutex.unlock();
 
     //2. 解析日志消息内容
     //2.1 格式化解析可变参数列表
@@ -160,12 +487,8 @@ void Log::write_log(int level, const char *format, ...)
     m_mutex.unlock();
 
     //3. 将日志消息写入阻塞队列（异步）or直接写入日志文件（同步）
-    if (m_is_async && !m_log_queue->full())
-    {
-        //异步写日志，将日志消息写入阻塞队列
-        m_log_queue->push(log_str);
-    }
-    else
+    //异步写日志，将日志消息写入阻塞队列；队列已满或已关闭时push失败，改为同步写入
+    if (!m_is_async || !m_log_queue->push(log_str))
     {
         //同步写日志，直接将日志消息写入文件
         m_mutex.lock();
@@ -183,3 +506,18 @@ void Log::flush(void)
     fflush(m_fp);
     m_mutex.unlock();
 }
+
+void Log::stop()
+{
+    //未初始化(关闭日志)时没有后台线程
+    if (!m_task_queue)
+        return;
+    if (m_is_async)
+    {
+        m_log_queue->close();
+        pthread_join(m_write_tid, NULL);
+    }
+    m_task_queue->close();
+    pthread_join(m_rotate_tid, NULL);
+    flush();
+}
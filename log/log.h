@@ -6,10 +6,19 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
+#include <time.h>
 #include "block_queue.h"
 
 using namespace std;
 
+//交给后台维护线程的文件任务
+struct log_task
+{
+    int type;    //见Log::TASK_TYPE
+    FILE *fp;    //待关闭的文件
+    string path; //文件路径
+};
+
 class Log
 {
 public:
@@ -28,13 +37,22 @@ public:
         // Log类的唯一实例指针
         // 类内访问静态成员，也需要声明作用域 ::
         Log::get_instance()->async_write_log(); // 调用日志实例的异步写日志方法
+        return NULL;
+    }
+
+    // 后台维护线程：预先打开下一个文件、关闭/压缩切分出的旧文件、按数量和大小清理
+    static void *rotate_log_thread(void *args)
+    {
+        Log::get_instance()->async_rotate_log();
+        return NULL;
     }
 
     
     // 可选的参数有: 日志文件，日志缓冲区大小，最大行数，
-    // 和最长日志条队列
+    // 和最长日志条队列，是否gzip压缩切分出的旧文件，旧文件保留的最大个数和总字节数(0为不限)
     bool init(const char *file_name, int close_log, int log_buf_size = 8192, 
-    int split_lines = 5000000, int max_queue_size = 0);
+    int split_lines = 5000000, int max_queue_size = 0,
+    int compress = 0, int max_files = 0, long long max_bytes = 0);
 
     // 将输出内容按照标准格式整理
     // ... 表示 可变参数列表
@@ -44,7 +62,16 @@ public:
     // 强制刷新缓冲区
     void flush(void);
 
+    // 退出前调用一次：写线程写完队列中剩余的日志、维护线程处理完切分出的文件后退出，之后的日志同步写入
+    void stop();
+
 private:
+    enum TASK_TYPE
+    {
+        TASK_PREOPEN = 0, // 预先打开path
+        TASK_CLOSE,       // 关闭切分出的旧文件，按需压缩并清理
+        TASK_DISCARD      // 关闭未用上的预打开文件，为空则删除
+    };
  
     Log(); // 构造函数
     virtual ~Log(); // 虚析构函数
@@ -55,14 +82,31 @@ private:
         string single_log; // 单条日志字符串
  
         // 从阻塞队列中取出一条日志内容，写入文件
+        // 行数统计和文件切换也在写线程中完成，请求线程只负责入队
         while (m_log_queue->pop(single_log)) // 从阻塞队列中取出日志
         {
             m_mutex.lock(); // 加锁
+            check_rotate(time(NULL));
             fputs(single_log.c_str(), m_fp); // 将日志内容写入文件
             m_mutex.unlock(); // 解锁
         }
+        return NULL;
     }
 
+    void async_rotate_log();
+
+    // 计数并在跨天或达到最大行数时切换文件，调用时需持有m_mutex
+    void check_rotate(time_t now);
+    // 生成切分文件名，day为文件所属日期，part为0时不带序号，路径过长返回false
+    bool make_log_name(char *buf, const struct tm &day, long long part);
+    // 计算now之后的下一个零点
+    void update_next_midnight(time_t now);
+    // 将任务交给维护线程，队列满或已停止时在当前线程只关闭文件(不压缩、不清理)，调用时需持有m_mutex
+    void post_task(int type, FILE *fp, const string &path);
+    void handle_task(log_task &task);
+    // 按保留个数和总大小删除最旧的日志文件
+    void apply_retention();
+
 private:
 
     char dir_name[128]; // 路径名
@@ -77,11 +121,28 @@ private:
     bool m_is_async; // 是否同步标志位
     locker m_mutex; // 同步类
     int m_close_log; //关闭日志
+
+    // 文件切换相关，均由m_mutex保护
+    time_t m_next_midnight; // 下一次按天切分的时刻
+    long long m_preopen_line; // 行数达到该值(取模后)时预打开下一个切分文件
+    char m_cur_name[256]; // 当前文件名
+    FILE *m_next_fp; // 已预先打开的下一个文件
+    char m_next_name[256]; // 预打开文件名
+    bool m_preopen_pending; // 已请求预打开，尚未切换
+
+    block_queue<log_task> *m_task_queue; // 维护线程任务队列
+    pthread_t m_write_tid; // 异步写线程
+    pthread_t m_rotate_tid; // 维护线程
+    int m_compress; // 是否压缩旧文件
+    int m_max_files; // 旧文件保留个数
+    long long m_max_bytes; // 旧文件保留总字节数
 };
 
 #define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
 #define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
 #define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
 #define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+//访问日志量大，不强制刷新，异步模式下只入队由写线程落盘
+#define LOG_ACCESS(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(4, format, ##__VA_ARGS__);}
 
 #endif
@@ -1,4 +1,4 @@
-#include "config.h"
+#include "webserver.h"
 
 int main(int argc, char *argv[])
 {
@@ -14,10 +14,7 @@ int main(int argc, char *argv[])
     WebServer server;
 
     //初始化
-    server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
-                config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
-    
+    server.init(config, user, passwd, databasename);
 
     //日志
     server.log_write();
@@ -28,6 +25,9 @@ int main(int argc, char *argv[])
     //线程池
     server.thread_pool();
 
+    //按IP限流
+    server.rate_limit();
+
     //触发模式
     server.trig_mode();
 
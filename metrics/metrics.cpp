@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+
+__thread metrics::slot *metrics::t_slot = NULL;
+metrics::slot metrics::m_slots[MAX_THREADS + 1];
+std::atomic<int> metrics::m_next(0);
+std::vector<std::pair<metrics::collector, void *> > metrics::m_collectors;
+
+//线程第一次记录时领取槽，线程退出后槽不回收(工作线程与进程同寿命)
+metrics::slot *metrics::claim()
+{
+    int idx = m_next.fetch_add(1, std::memory_order_relaxed);
+    t_slot = idx < MAX_THREADS ? &m_slots[idx + 1] : &m_slots[0];
+    return t_slot;
+}
+
+uint64_t metrics::bucket_upper(int idx)
+{
+    if (idx < SUB_COUNT)
+        return idx + 1;
+    int e = SUB_BITS + (idx - SUB_COUNT) / SUB_COUNT;
+    uint64_t sub = (idx - SUB_COUNT) % SUB_COUNT;
+    return (SUB_COUNT + sub + 1) << (e - SUB_BITS);
+}
+
+void metrics::add_collector(collector fn, void *arg)
+{
+    m_collectors.push_back(std::make_pair(fn, arg));
+}
+
+void metrics::counter(string &out, const char *name, const char *help, unsigned long long value)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+    out += buf;
+}
+
+void metrics::gauge(string &out, const char *name, const char *help, double value)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", name, help, name, name, value);
+    out += buf;
+}
+
+//Prometheus的桶取2的幂微秒(16us~33s)，与HDR桶的边界重合，累计值是精确的；
+//分位数另用HDR的全部桶计算，取所在桶的上界
+void metrics::histogram(string &out, const char *name, const char *help, const uint64_t *buckets, uint64_t sum)
+{
+    static const int LE_MIN = 4, LE_MAX = 25;
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    char buf[512];
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i)
+        total += buckets[i];
+
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    out += buf;
+    uint64_t cumulative = 0;
+    int idx = 0;
+    for (int k = LE_MIN; k <= LE_MAX; ++k)
+    {
+        int end = SUB_COUNT + (k - SUB_BITS) * SUB_COUNT;
+        for (; idx < end; ++idx)
+            cumulative += buckets[idx];
+        snprintf(buf, sizeof(buf), "%s_bucket{le=\"%.6f\"} %llu\n", name, (double)(1ULL << k) / 1000000, (unsigned long long)cumulative);
+        out += buf;
+    }
+    snprintf(buf, sizeof(buf), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.6f\n%s_count %llu\n",
+             name, (unsigned long long)total, name, sum / 1000000.0, name, (unsigned long long)total);
+    out += buf;
+
+    snprintf(buf, sizeof(buf), "# HELP %s_quantile %s, HDR estimate\n# TYPE %s_quantile gauge\n", name, help, name);
+    out += buf;
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+    {
+        uint64_t rank = (uint64_t)(quantiles[q] * total);
+        uint64_t seen = 0;
+        uint64_t value = 0;
+        for (int i = 0; i < HIST_BUCKETS && total > 0; ++i)
+        {
+            seen += buckets[i];
+            if (seen > rank)
+            {
+                value = bucket_upper(i) - 1;
+                break;
+            }
+        }
+        snprintf(buf, sizeof(buf), "%s_quantile{quantile=\"%g\"} %.6f\n", name, quantiles[q], value / 1000000.0);
+        out += buf;
+    }
+}
+
+void metrics::render(string &out)
+{
+    static const char *hist_names[M_HIST_NUM] = {
+        "webserver_request_duration_seconds",
+        "webserver_queue_wait_seconds",
+        "webserver_handle_duration_seconds"};
+    static const char *hist_help[M_HIST_NUM] = {
+        "Time from the first request byte to the last response byte",
+        "Time spent in the worker queue",
+        "Time from request parsed to response generated"};
+
+    uint64_t counters[M_COUNTER_NUM];
+    uint64_t hist[M_HIST_NUM][HIST_BUCKETS];
+    uint64_t hist_sum[M_HIST_NUM];
+    memset(counters, 0, sizeof(counters));
+    memset(hist, 0, sizeof(hist));
+    memset(hist_sum, 0, sizeof(hist_sum));
+
+    int used = m_next.load(std::memory_order_relaxed);
+    if (used > MAX_THREADS)
+        used = MAX_THREADS;
+    for (int i = 0; i <= used; ++i)
+    {
+        slot &s = m_slots[i];
+        for (int c = 0; c < M_COUNTER_NUM; ++c)
+            counters[c] += __atomic_load_n(&s.counters[c], __ATOMIC_RELAXED);
+        for (int h = 0; h < M_HIST_NUM; ++h)
+        {
+            for (int b = 0; b < HIST_BUCKETS; ++b)
+                hist[h][b] += __atomic_load_n(&s.hist[h][b], __ATOMIC_RELAXED);
+            hist_sum[h] += __atomic_load_n(&s.hist_sum[h], __ATOMIC_RELAXED);
+        }
+    }
+
+    char buf[512];
+    counter(out, "webserver_connections_accepted_total", "Accepted connections", counters[M_CONN_ACCEPTED]);
+    out += "# HELP webserver_http_responses_total Responses sent, by status class\n"
+           "# TYPE webserver_http_responses_total counter\n";
+    static const char *classes[] = {"2xx", "3xx", "4xx", "5xx"};
+    for (int i = 0; i < 4; ++i)
+    {
+        snprintf(buf, sizeof(buf), "webserver_http_responses_total{code=\"%s\"} %llu\n",
+                 classes[i], (unsigned long long)counters[M_RESP_2XX + i]);
+        out += buf;
+    }
+    counter(out, "webserver_sent_bytes_total", "Response bytes sent", counters[M_BYTES_SENT]);
+    for (int h = 0; h < M_HIST_NUM; ++h)
+        histogram(out, hist_names[h], hist_help[h], hist[h], hist_sum[h]);
+
+    for (size_t i = 0; i < m_collectors.size(); ++i)
+        m_collectors[i].first(m_collectors[i].second, out);
+}
@@ -0,0 +1,114 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+using std::string;
+
+//计数器
+enum METRIC_COUNTER
+{
+    M_CONN_ACCEPTED = 0, //建立的连接
+    M_RESP_2XX,          //发送完毕的响应，按状态码分类
+    M_RESP_3XX,
+    M_RESP_4XX,
+    M_RESP_5XX,
+    M_BYTES_SENT,        //响应字节数
+    M_COUNTER_NUM
+};
+
+//延迟直方图，单位微秒
+enum METRIC_HIST
+{
+    H_REQUEST = 0, //读到请求第一个字节到响应发送完毕
+    H_QUEUE_WAIT,  //在工作队列中的排队时间
+    H_HANDLE,      //请求解析完成到响应生成(含异步存储和口令哈希)
+    M_HIST_NUM
+};
+
+/*************************************************************
+*运行时指标
+*每个线程第一次记录时领取一个独占的槽，槽按缓存行对齐，
+*记录只是对本线程槽的一次读改写(relaxed，不加锁、不带lock前缀)，
+*读取时把所有槽加起来，读到的是近似的快照
+*直方图按HDR方式分桶：每个2的幂区间再均分8份，相对误差不超过12.5%
+**************************************************************/
+class metrics
+{
+public:
+    static const int SUB_BITS = 3;                  //每个2的幂区间分成2^SUB_BITS个桶
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_EXP = 40;                  //超过2^40微秒的值计入最后一个桶
+    static const int HIST_BUCKETS = SUB_COUNT + (MAX_EXP - SUB_BITS) * SUB_COUNT;
+    static const int MAX_THREADS = 256;             //独占槽数，更多的线程共用一个原子累加的槽
+
+    struct alignas(64) slot
+    {
+        uint64_t counters[M_COUNTER_NUM];
+        uint64_t hist[M_HIST_NUM][HIST_BUCKETS];
+        uint64_t hist_sum[M_HIST_NUM];
+    };
+
+    static inline void inc(METRIC_COUNTER c, uint64_t n = 1)
+    {
+        slot *s = local();
+        bump(s, &s->counters[c], n);
+    }
+    static inline void record(METRIC_HIST h, long long us)
+    {
+        if (us < 0)
+            us = 0;
+        slot *s = local();
+        bump(s, &s->hist[h][bucket_index(us)], 1);
+        bump(s, &s->hist_sum[h], us);
+    }
+
+    //值所在的桶：小于8的值各占一个桶，之后每个2的幂区间8个桶
+    static inline int bucket_index(uint64_t v)
+    {
+        if (v < (uint64_t)SUB_COUNT)
+            return (int)v;
+        int e = 63 - __builtin_clzll(v);
+        if (e >= MAX_EXP)
+            return HIST_BUCKETS - 1;
+        return SUB_COUNT + (e - SUB_BITS) * SUB_COUNT + (int)((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+    //桶的上界(不含)
+    static uint64_t bucket_upper(int idx);
+
+    //抓取时追加其它模块的指标(队列长度、连接数等)，在启动阶段注册
+    typedef void (*collector)(void *arg, string &out);
+    static void add_collector(collector fn, void *arg);
+
+    //Prometheus文本格式
+    static void render(string &out);
+    static void counter(string &out, const char *name, const char *help, unsigned long long value);
+    static void gauge(string &out, const char *name, const char *help, double value);
+
+private:
+    static inline slot *local()
+    {
+        slot *s = t_slot;
+        return s ? s : claim();
+    }
+    //独占槽只有本线程写，读改写不需要原子指令，relaxed读写保证读取方不会读到撕裂的值
+    static inline void bump(slot *s, uint64_t *p, uint64_t n)
+    {
+        if (s == &m_slots[0])
+            __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+        else
+            __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+    }
+    static slot *claim();
+    static void histogram(string &out, const char *name, const char *help, const uint64_t *buckets, uint64_t sum);
+
+    static __thread slot *t_slot;
+    static slot m_slots[MAX_THREADS + 1]; //0号为共用槽
+    static std::atomic<int> m_next;
+    static std::vector<std::pair<collector, void *> > m_collectors;
+};
+
+#endif
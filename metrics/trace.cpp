@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include "trace.h"
+
+long long trace::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+#ifdef REQ_TRACE
+static const char *stage_name[T_STAGE_NUM] = {"dispatch", "read", "queue", "process", "do_request", "write"};
+
+//写入方先把seq清零，写完字段再发布seq，读取方前后两次seq一致才采用，不会读到写了一半的记录
+struct ring_slot
+{
+    std::atomic<unsigned long long> seq;
+    long long start_us;
+    unsigned int dur_us;
+    unsigned int id;
+    int tid;
+    int stage;
+};
+
+static ring_slot ring[1 << trace::RING_BITS];
+static std::atomic<unsigned long long> ring_pos(0);
+static __thread int cached_tid = 0;
+
+void trace::span(TRACE_STAGE stage, unsigned int id, long long start_us, long long end_us)
+{
+    if (0 == cached_tid)
+        cached_tid = syscall(SYS_gettid);
+    unsigned long long pos = ring_pos.fetch_add(1, std::memory_order_relaxed);
+    ring_slot &s = ring[pos & ((1 << RING_BITS) - 1)];
+    s.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.start_us = start_us;
+    s.dur_us = end_us > start_us ? end_us - start_us : 0;
+    s.id = id;
+    s.tid = cached_tid;
+    s.stage = stage;
+    s.seq.store(pos + 1, std::memory_order_release);
+}
+
+void trace::dump(string &out)
+{
+    unsigned long long end = ring_pos.load(std::memory_order_acquire);
+    unsigned long long begin = end > (1ULL << RING_BITS) ? end - (1ULL << RING_BITS) : 0;
+    char buf[256];
+    bool first = true;
+    out += "{\"traceEvents\":[\n";
+    for (unsigned long long pos = begin; pos < end; ++pos)
+    {
+        ring_slot &s = ring[pos & ((1 << RING_BITS) - 1)];
+        if (s.seq.load(std::memory_order_acquire) != pos + 1)
+            continue;
+        event e = {s.start_us, s.dur_us, s.id, s.tid, s.stage};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != pos + 1)
+            continue;
+        snprintf(buf, sizeof(buf),
+                 "%s{\"name\":\"%s\",\"cat\":\"webserver\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%u,\"pid\":1,\"tid\":%u,\"args\":{\"thread\":%d}}",
+                 first ? "" : ",\n", stage_name[e.stage], e.start_us, e.dur_us, e.id, e.tid);
+        out += buf;
+        first = false;
+    }
+    out += "\n]}\n";
+}
+#else
+void trace::span(TRACE_STAGE, unsigned int, long long, long long)
+{
+}
+
+//未开启跟踪时返回空的事件列表
+void trace::dump(string &out)
+{
+    out += "{\"traceEvents\":[]}\n";
+}
+#endif
@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string>
+
+using std::string;
+
+/*************************************************************
+*请求各阶段的跟踪点
+*1. USDT静态探针：有<sys/sdt.h>时编入，未挂载时只是一条nop，
+*   用bpftrace/perf按需挂载，如 bpftrace -e 'usdt:./server:webserver:queue { @[arg1 / 1000] = count(); }'
+*2. make TRACE=1(-DREQ_TRACE)编译时，各阶段的耗时区间写入一个全局环形缓冲区，
+*   可从管理端口的/trace取出最近的记录，格式为Chrome trace JSON(chrome://tracing或Perfetto打开)，
+*   每个连接一条泳道，同一连接上长连接的各个请求依次排列
+**************************************************************/
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT 1
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#define WS_PROBE1(name, a) DTRACE_PROBE1(webserver, name, a)
+#define WS_PROBE2(name, a, b) DTRACE_PROBE2(webserver, name, a, b)
+#define WS_PROBE3(name, a, b, c) DTRACE_PROBE3(webserver, name, a, b, c)
+#else
+#define WS_PROBE1(name, a) do {} while (0)
+#define WS_PROBE2(name, a, b) do {} while (0)
+#define WS_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+//跟踪的阶段
+enum TRACE_STAGE
+{
+    T_DISPATCH = 0, //主线程处理一个epoll事件
+    T_READ,         //read_once
+    T_QUEUE,        //在工作队列中排队
+    T_PROCESS,      //解析请求并生成响应
+    T_DO_REQUEST,   //do_request(stat/mmap/存储)
+    T_WRITE,        //一次writev
+    T_STAGE_NUM
+};
+
+class trace
+{
+public:
+    static const int RING_BITS = 16; //保留最近65536个区间
+
+    //单调时钟，微秒
+    static long long now_us();
+    //记录一个区间，id为连接编号
+    static void span(TRACE_STAGE stage, unsigned int id, long long start_us, long long end_us);
+    //缓冲区中的区间转为Chrome trace JSON
+    static void dump(string &out);
+
+private:
+    struct event
+    {
+        long long start_us;
+        unsigned int dur_us;
+        unsigned int id;
+        int tid;
+        int stage;
+    };
+};
+
+#ifdef REQ_TRACE
+//作用域内的耗时计为一个区间
+class trace_scope
+{
+public:
+    trace_scope(TRACE_STAGE stage, unsigned int id) : m_stage(stage), m_id(id), m_start(trace::now_us()) {}
+    ~trace_scope() { trace::span(m_stage, m_id, m_start, trace::now_us()); }
+
+private:
+    TRACE_STAGE m_stage;
+    unsigned int m_id;
+    long long m_start;
+};
+#define TRACE_SCOPE(stage, id) trace_scope trace_scope_obj(stage, id)
+#define TRACE_SPAN(stage, id, start, end) trace::span(stage, id, start, end)
+#else
+#define TRACE_SCOPE(stage, id) do {} while (0)
+#define TRACE_SPAN(stage, id, start, end) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,662 @@
+//基于epoll的多线程压测工具：长连接、流水线、固定速率(开环)、登录/注册负载，输出JSON
+//闭环(默认)：每个连接始终保持-p个请求在途，收到响应立即发下一个
+//开环(-r)：按固定速率排定每个请求的发送时刻，延迟从排定时刻起算，
+//服务端变慢导致请求晚发的那段时间也计入延迟(修正coordinated omission)，同时给出从实际发送起算的延迟作对比
+//用法：./loadgen [-c 连接数] [-t 线程数] [-d 秒数] [-p 流水线深度] [-r 每秒请求数] [-k 0关闭长连接]
+//               [-w get:80,login:15,register:5] [-U 用户名] [-P 密码] [-T 超时毫秒] http://127.0.0.1:9006/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+using namespace std;
+
+enum WORKLOAD
+{
+    W_GET = 0,
+    W_LOGIN,
+    W_REGISTER,
+    W_NUM
+};
+static const char *workload_name[W_NUM] = {"get", "login", "register"};
+
+struct options
+{
+    int connections;
+    int threads;
+    int seconds;
+    int pipeline;
+    double rate;        //总请求速率，0为闭环
+    bool keepalive;
+    int timeout_ms;
+    int weight[W_NUM];
+    string host;
+    int port;
+    string path;
+    string user;
+    string passwd;
+    struct sockaddr_in addr;
+};
+static options opt;
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+//在途请求的排定时刻和实际发送时刻
+struct inflight
+{
+    long long intended;
+    long long sent;
+};
+
+enum PARSE_STATE
+{
+    P_HEADER = 0,
+    P_BODY,       //Content-Length消息体
+    P_CHUNK_SIZE,
+    P_CHUNK_DATA,
+    P_CHUNK_CRLF,
+    P_TRAILER
+};
+
+struct conn
+{
+    int fd;
+    bool connecting;
+    string out;
+    size_t out_off;
+    deque<inflight> pending;
+    long long next_due;  //开环：下一个请求的排定时刻
+    long long interval;  //开环：本连接的请求间隔
+    unsigned int seq;    //注册用户名序号
+
+    //响应解析
+    string in;
+    PARSE_STATE state;
+    int status;
+    long long body_left;
+    bool chunked;
+    bool server_close;
+};
+
+struct worker
+{
+    int id;
+    int epollfd;
+    vector<conn> conns;
+    long long deadline;
+    unsigned int rand_state;
+
+    vector<long long> latency;            //开环时为修正后的延迟
+    vector<long long> latency_uncorrected;
+    long long status[6];                  //1xx~5xx，0为其它
+    long long errors;
+    long long timeouts;
+    long long bytes;
+    long long reconnects;
+};
+
+static bool parse_url(const char *url)
+{
+    const char *p = url;
+    if (strncmp(p, "http://", 7) == 0)
+        p += 7;
+    const char *slash = strchr(p, '/');
+    string hostport = slash ? string(p, slash - p) : string(p);
+    opt.path = slash ? string(slash) : "/";
+    size_t colon = hostport.find(':');
+    opt.host = hostport.substr(0, colon);
+    opt.port = colon == string::npos ? 80 : atoi(hostport.c_str() + colon + 1);
+    memset(&opt.addr, 0, sizeof(opt.addr));
+    opt.addr.sin_family = AF_INET;
+    opt.addr.sin_port = htons(opt.port);
+    return inet_pton(AF_INET, opt.host.c_str(), &opt.addr.sin_addr) == 1;
+}
+
+//get:80,login:15,register:5
+static bool parse_workload(const char *spec)
+{
+    memset(opt.weight, 0, sizeof(opt.weight));
+    string s(spec);
+    size_t start = 0;
+    while (start < s.size())
+    {
+        size_t end = s.find(',', start);
+        if (end == string::npos)
+            end = s.size();
+        string item = s.substr(start, end - start);
+        size_t colon = item.find(':');
+        string name = item.substr(0, colon);
+        int weight = colon == string::npos ? 1 : atoi(item.c_str() + colon + 1);
+        int w = 0;
+        for (; w < W_NUM; ++w)
+            if (name == workload_name[w])
+                break;
+        if (w == W_NUM || weight < 0)
+            return false;
+        opt.weight[w] = weight;
+        start = end + 1;
+    }
+    return opt.weight[W_GET] + opt.weight[W_LOGIN] + opt.weight[W_REGISTER] > 0;
+}
+
+static void build_request(worker *w, conn *c, string &out)
+{
+    int total = opt.weight[W_GET] + opt.weight[W_LOGIN] + opt.weight[W_REGISTER];
+    int pick = rand_r(&w->rand_state) % total;
+    int type = W_GET;
+    while (pick >= opt.weight[type])
+        pick -= opt.weight[type++];
+
+    const char *connection = opt.keepalive ? "keep-alive" : "close";
+    char head[512];
+    if (W_GET == type)
+    {
+        snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                 opt.path.c_str(), opt.host.c_str(), connection);
+        out += head;
+        return;
+    }
+
+    char body[256];
+    if (W_LOGIN == type)
+        snprintf(body, sizeof(body), "user=%s&password=%s", opt.user.c_str(), opt.passwd.c_str());
+    else
+        snprintf(body, sizeof(body), "user=lg%d_%d_%d_%u&password=%s", (int)getpid(), w->id,
+                 (int)(c - &w->conns[0]), c->seq++, opt.passwd.c_str());
+    snprintf(head, sizeof(head),
+             "POST /%dCGISQL.cgi HTTP/1.1\r\nHost: %s\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+             "Content-Length: %zu\r\nConnection: %s\r\n\r\n",
+             W_LOGIN == type ? 2 : 3, opt.host.c_str(), strlen(body), connection);
+    out += head;
+    out += body;
+}
+
+static void open_conn(worker *w, conn *c)
+{
+    c->fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int flag = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    c->connecting = true;
+    c->out.clear();
+    c->out_off = 0;
+    c->in.clear();
+    c->state = P_HEADER;
+    if (connect(c->fd, (struct sockaddr *)&opt.addr, sizeof(opt.addr)) < 0 && errno != EINPROGRESS)
+        ++w->errors;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.ptr = c;
+    epoll_ctl(w->epollfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+//重新建连，failed时在途请求计为错误；开环的排定时刻照常推进，不补发
+static void reset_conn(worker *w, conn *c, bool failed)
+{
+    if (failed)
+        w->errors += c->pending.size();
+    c->pending.clear();
+    epoll_ctl(w->epollfd, EPOLL_CTL_DEL, c->fd, 0);
+    //RST关闭，压测机不留TIME_WAIT
+    struct linger tmp = {1, 0};
+    setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+    close(c->fd);
+    ++w->reconnects;
+    open_conn(w, c);
+}
+
+static bool flush(worker *w, conn *c)
+{
+    while (c->out_off < c->out.size())
+    {
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        c->out_off += n;
+    }
+    c->out.clear();
+    c->out_off = 0;
+    return true;
+}
+
+//补足在途请求：闭环补到流水线深度，开环只发已到排定时刻的
+static bool fill(worker *w, conn *c, long long now)
+{
+    if (c->connecting)
+        return true;
+    int depth = opt.keepalive ? opt.pipeline : 1;
+    while ((int)c->pending.size() < depth)
+    {
+        inflight req;
+        if (opt.rate > 0)
+        {
+            if (c->next_due > now)
+                break;
+            req.intended = c->next_due;
+            c->next_due += c->interval;
+        }
+        else
+            req.intended = now;
+        req.sent = now;
+        c->pending.push_back(req);
+        build_request(w, c, c->out);
+    }
+    return flush(w, c);
+}
+
+static void complete(worker *w, conn *c, long long now)
+{
+    if (c->pending.empty())
+        return;
+    inflight req = c->pending.front();
+    c->pending.pop_front();
+    if (now > w->deadline)
+        return;
+    w->latency.push_back(now - req.intended);
+    if (opt.rate > 0)
+        w->latency_uncorrected.push_back(now - req.sent);
+    int cls = c->status / 100;
+    ++w->status[cls >= 1 && cls <= 5 ? cls : 0];
+}
+
+//解析响应，只关心状态码、消息体长度和是否关闭连接，消息体内容直接丢弃
+//返回false表示格式错误
+static bool parse(worker *w, conn *c, long long now)
+{
+    size_t pos = 0;
+    while (pos < c->in.size())
+    {
+        if (P_HEADER == c->state)
+        {
+            size_t end = c->in.find("\r\n\r\n", pos);
+            if (end == string::npos)
+                break;
+            const char *p = c->in.c_str() + pos;
+            if (strncmp(p, "HTTP/1.", 7) != 0)
+                return false;
+            c->status = atoi(p + 9);
+            c->body_left = 0;
+            c->chunked = false;
+            c->server_close = false;
+            //逐行取头部，服务器可能省略冒号后的空格
+            size_t line = c->in.find("\r\n", pos) + 2;
+            while (line < end)
+            {
+                size_t eol = c->in.find("\r\n", line);
+                const char *h = c->in.c_str() + line;
+                const char *v = strchr(h, ':');
+                if (v && v < c->in.c_str() + eol)
+                {
+                    ++v;
+                    while (*v == ' ' || *v == '\t')
+                        ++v;
+                    if (strncasecmp(h, "Content-Length:", 15) == 0)
+                        c->body_left = atoll(v);
+                    else if (strncasecmp(h, "Transfer-Encoding:", 18) == 0 && strncasecmp(v, "chunked", 7) == 0)
+                        c->chunked = true;
+                    else if (strncasecmp(h, "Connection:", 11) == 0 && strncasecmp(v, "close", 5) == 0)
+                        c->server_close = true;
+                }
+                line = eol + 2;
+            }
+            pos = end + 4;
+            if (c->status >= 100 && c->status < 200)
+                continue;
+            c->state = c->chunked ? P_CHUNK_SIZE : P_BODY;
+        }
+        else if (P_BODY == c->state)
+        {
+            long long n = min((long long)(c->in.size() - pos), c->body_left);
+            pos += n;
+            c->body_left -= n;
+        }
+        else if (P_CHUNK_SIZE == c->state || P_TRAILER == c->state)
+        {
+            size_t eol = c->in.find("\r\n", pos);
+            if (eol == string::npos)
+                break;
+            if (P_CHUNK_SIZE == c->state)
+            {
+                c->body_left = strtoll(c->in.c_str() + pos, NULL, 16);
+                c->state = c->body_left > 0 ? P_CHUNK_DATA : P_TRAILER;
+            }
+            else if (eol == pos)
+                c->state = P_BODY; //空行：分块消息体结束，body_left为0
+            pos = eol + 2;
+        }
+        else if (P_CHUNK_DATA == c->state)
+        {
+            long long n = min((long long)(c->in.size() - pos), c->body_left);
+            pos += n;
+            c->body_left -= n;
+            if (0 == c->body_left)
+                c->state = P_CHUNK_CRLF;
+        }
+        else if (P_CHUNK_CRLF == c->state)
+        {
+            if (c->in.size() - pos < 2)
+                break;
+            pos += 2;
+            c->state = P_CHUNK_SIZE;
+        }
+
+        //一个响应结束
+        if (P_BODY == c->state && 0 == c->body_left)
+        {
+            complete(w, c, now);
+            c->state = P_HEADER;
+            if (c->server_close || !opt.keepalive)
+            {
+                c->in.clear();
+                reset_conn(w, c, c->server_close && opt.keepalive);
+                return true;
+            }
+        }
+    }
+    c->in.erase(0, pos);
+    return true;
+}
+
+static void on_readable(worker *w, conn *c, long long now)
+{
+    char buf[65536];
+    while (true)
+    {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            w->bytes += n;
+            c->in.append(buf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        //对方关闭：先处理已收到的完整响应，空闲连接被关闭不算错误
+        long long reconnects = w->reconnects;
+        if (!parse(w, c, now))
+        {
+            reset_conn(w, c, true);
+            return;
+        }
+        if (reconnects == w->reconnects)
+            reset_conn(w, c, !c->pending.empty());
+        return;
+    }
+    if (!parse(w, c, now))
+        reset_conn(w, c, true);
+}
+
+static void *run(void *arg)
+{
+    worker *w = (worker *)arg;
+    long long start = now_us();
+    for (size_t i = 0; i < w->conns.size(); ++i)
+    {
+        conn *c = &w->conns[i];
+        //开环：各连接的起始时刻错开，避免每个间隔开头集中发送
+        c->next_due = start + (c->interval * i) / w->conns.size();
+        open_conn(w, c);
+    }
+
+    epoll_event events[1024];
+    long long last_check = start;
+    while (true)
+    {
+        long long now = now_us();
+        if (now >= w->deadline)
+            break;
+        int wait_ms = 100;
+        if (opt.rate > 0)
+        {
+            long long next = w->deadline;
+            for (size_t i = 0; i < w->conns.size(); ++i)
+                if (!w->conns[i].connecting && w->conns[i].next_due < next)
+                    next = w->conns[i].next_due;
+            //向下取整，不足1毫秒时不阻塞，发送时刻不因epoll_wait的毫秒精度推迟，否则这段延迟会被算到服务端头上
+            wait_ms = next <= now ? 0 : (int)min(100LL, (next - now) / 1000);
+        }
+        int n = epoll_wait(w->epollfd, events, 1024, wait_ms);
+        now = now_us();
+        for (int i = 0; i < n; ++i)
+        {
+            conn *c = (conn *)events[i].data.ptr;
+            if (c->connecting)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err || (events[i].events & (EPOLLERR | EPOLLHUP)))
+                {
+                    ++w->errors;
+                    reset_conn(w, c, false);
+                    continue;
+                }
+                if (!(events[i].events & EPOLLOUT))
+                    continue;
+                c->connecting = false;
+            }
+            if (events[i].events & EPOLLIN)
+                on_readable(w, c, now);
+            else if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                reset_conn(w, c, true);
+                continue;
+            }
+            if (!fill(w, c, now))
+                reset_conn(w, c, true);
+        }
+        if (opt.rate > 0)
+        {
+            for (size_t i = 0; i < w->conns.size(); ++i)
+                if (!fill(w, &w->conns[i], now))
+                    reset_conn(w, &w->conns[i], true);
+        }
+        //最早的在途请求超时：服务端不再响应，丢弃连接重发
+        if (now - last_check >= 100000)
+        {
+            last_check = now;
+            for (size_t i = 0; i < w->conns.size(); ++i)
+            {
+                conn *c = &w->conns[i];
+                if (!c->pending.empty() && now - c->pending.front().sent > opt.timeout_ms * 1000LL)
+                {
+                    w->timeouts += c->pending.size();
+                    reset_conn(w, c, false);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < w->conns.size(); ++i)
+        close(w->conns[i].fd);
+    close(w->epollfd);
+    return NULL;
+}
+
+//登录负载需要的账号，开始前注册一次，已存在也无妨
+static void register_user()
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&opt.addr, sizeof(opt.addr)) < 0)
+    {
+        close(fd);
+        return;
+    }
+    char body[256], req[512];
+    snprintf(body, sizeof(body), "user=%s&password=%s", opt.user.c_str(), opt.passwd.c_str());
+    snprintf(req, sizeof(req),
+             "POST /3CGISQL.cgi HTTP/1.1\r\nHost: %s\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
+             opt.host.c_str(), strlen(body), body);
+    send(fd, req, strlen(req), MSG_NOSIGNAL);
+    char buf[4096];
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+        ;
+    close(fd);
+}
+
+static long long percentile(const vector<long long> &v, double q)
+{
+    if (v.empty())
+        return 0;
+    size_t idx = (size_t)(q * v.size());
+    return v[min(idx, v.size() - 1)];
+}
+
+static void print_latency(const char *name, vector<long long> &v, bool last)
+{
+    sort(v.begin(), v.end());
+    double mean = 0;
+    for (size_t i = 0; i < v.size(); ++i)
+        mean += v[i];
+    if (!v.empty())
+        mean /= v.size();
+    printf("  \"%s\": {\"min\": %lld, \"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p99.9\": %lld, \"max\": %lld}%s\n",
+           name, v.empty() ? 0 : v.front(), mean, percentile(v, 0.5), percentile(v, 0.9), percentile(v, 0.99),
+           percentile(v, 0.999), v.empty() ? 0 : v.back(), last ? "" : ",");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-c conns] [-t threads] [-d seconds] [-p pipeline] [-r rate] [-k 0|1]\n"
+                    "          [-w get:80,login:15,register:5] [-U user] [-P passwd] [-T timeout_ms] url\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    opt.connections = 64;
+    opt.threads = 4;
+    opt.seconds = 10;
+    opt.pipeline = 1;
+    opt.rate = 0;
+    opt.keepalive = true;
+    opt.timeout_ms = 5000;
+    opt.user = "loadgen";
+    opt.passwd = "loadgen";
+    parse_workload("get");
+
+    int ch;
+    while ((ch = getopt(argc, argv, "c:t:d:p:r:k:w:U:P:T:")) != -1)
+    {
+        switch (ch)
+        {
+        case 'c': opt.connections = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.seconds = atoi(optarg); break;
+        case 'p': opt.pipeline = atoi(optarg); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'k': opt.keepalive = atoi(optarg) != 0; break;
+        case 'w':
+            if (!parse_workload(optarg))
+                usage(argv[0]);
+            break;
+        case 'U': opt.user = optarg; break;
+        case 'P': opt.passwd = optarg; break;
+        case 'T': opt.timeout_ms = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc || !parse_url(argv[optind]))
+        usage(argv[0]);
+    if (opt.threads < 1)
+        opt.threads = 1;
+    if (opt.connections < opt.threads)
+        opt.connections = opt.threads;
+    if (opt.pipeline < 1)
+        opt.pipeline = 1;
+
+    if (opt.weight[W_LOGIN] > 0)
+        register_user();
+
+    vector<worker> workers(opt.threads);
+    vector<pthread_t> tids(opt.threads);
+    long long start = now_us();
+    //开环：总速率平均分到各连接
+    long long interval = opt.rate > 0 ? (long long)(1000000.0 * opt.connections / opt.rate) : 0;
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker &w = workers[i];
+        w.id = i;
+        w.epollfd = epoll_create1(EPOLL_CLOEXEC);
+        w.conns.resize(opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0));
+        for (size_t j = 0; j < w.conns.size(); ++j)
+        {
+            w.conns[j].interval = interval;
+            w.conns[j].seq = 0;
+        }
+        w.deadline = start + opt.seconds * 1000000LL;
+        w.rand_state = i * 7919 + 1;
+        memset(w.status, 0, sizeof(w.status));
+        w.errors = w.timeouts = w.bytes = w.reconnects = 0;
+    }
+    for (int i = 0; i < opt.threads; ++i)
+        pthread_create(&tids[i], NULL, run, &workers[i]);
+
+    vector<long long> latency, uncorrected;
+    long long status[6] = {0}, errors = 0, timeouts = 0, bytes = 0, reconnects = 0;
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        worker &w = workers[i];
+        latency.insert(latency.end(), w.latency.begin(), w.latency.end());
+        uncorrected.insert(uncorrected.end(), w.latency_uncorrected.begin(), w.latency_uncorrected.end());
+        for (int s = 0; s < 6; ++s)
+            status[s] += w.status[s];
+        errors += w.errors;
+        timeouts += w.timeouts;
+        bytes += w.bytes;
+        reconnects += w.reconnects;
+    }
+    double elapsed = (now_us() - start) / 1000000.0;
+
+    string workload;
+    for (int i = 0; i < W_NUM; ++i)
+    {
+        if (0 == opt.weight[i])
+            continue;
+        char item[32];
+        snprintf(item, sizeof(item), "%s%s:%d", workload.empty() ? "" : ",", workload_name[i], opt.weight[i]);
+        workload += item;
+    }
+
+    printf("{\n");
+    printf("  \"url\": \"http://%s:%d%s\",\n", opt.host.c_str(), opt.port, opt.path.c_str());
+    printf("  \"workload\": \"%s\",\n", workload.c_str());
+    printf("  \"threads\": %d, \"connections\": %d, \"pipeline\": %d, \"keepalive\": %s,\n",
+           opt.threads, opt.connections, opt.pipeline, opt.keepalive ? "true" : "false");
+    printf("  \"mode\": \"%s\", \"target_rate\": %.0f, \"duration_s\": %.2f,\n",
+           opt.rate > 0 ? "open" : "closed", opt.rate, elapsed);
+    printf("  \"requests\": %zu, \"rps\": %.1f, \"bytes\": %lld, \"reconnects\": %lld,\n",
+           latency.size(), latency.size() / elapsed, bytes, reconnects);
+    printf("  \"status\": {\"1xx\": %lld, \"2xx\": %lld, \"3xx\": %lld, \"4xx\": %lld, \"5xx\": %lld, \"other\": %lld},\n",
+           status[1], status[2], status[3], status[4], status[5], status[0]);
+    printf("  \"errors\": %lld, \"timeouts\": %lld,\n", errors, timeouts);
+    if (opt.rate > 0)
+        print_latency("latency_uncorrected_us", uncorrected, false);
+    print_latency("latency_us", latency, true);
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef MYSQL_STUB_H
+#define MYSQL_STUB_H
+
+/*************************************************************
+*libmysqlclient的替身，只声明服务器用到的接口，用于在没有数据库的环境中
+*编译MySQL后端(make server_stub)，连接池、connectionRAII和预编译语句都走真实代码
+*不定义MYSQL_WAIT_READ，异步客户端(async_sql)编译为不可用的分支
+**************************************************************/
+
+#include <stddef.h>
+
+typedef struct st_mysql MYSQL;
+typedef struct st_mysql_stmt MYSQL_STMT;
+typedef struct st_mysql_res MYSQL_RES;
+typedef char **MYSQL_ROW;
+
+enum enum_field_types
+{
+    MYSQL_TYPE_STRING = 254
+};
+
+enum mysql_option
+{
+    MYSQL_OPT_NONBLOCK = 6000
+};
+
+typedef struct st_mysql_bind
+{
+    unsigned long *length;
+    bool *is_null;
+    void *buffer;
+    unsigned long buffer_length;
+    enum enum_field_types buffer_type;
+} MYSQL_BIND;
+
+MYSQL *mysql_init(MYSQL *mysql);
+MYSQL *mysql_real_connect(MYSQL *mysql, const char *host, const char *user, const char *passwd, const char *db,
+                          unsigned int port, const char *unix_socket, unsigned long clientflag);
+int mysql_options(MYSQL *mysql, enum mysql_option option, const void *arg);
+void mysql_close(MYSQL *mysql);
+int mysql_ping(MYSQL *mysql);
+const char *mysql_error(MYSQL *mysql);
+int mysql_get_socket(const MYSQL *mysql);
+int mysql_query(MYSQL *mysql, const char *q);
+int mysql_real_query(MYSQL *mysql, const char *q, unsigned long length);
+unsigned long mysql_real_escape_string(MYSQL *mysql, char *to, const char *from, unsigned long length);
+MYSQL_RES *mysql_store_result(MYSQL *mysql);
+MYSQL_ROW mysql_fetch_row(MYSQL_RES *result);
+void mysql_free_result(MYSQL_RES *result);
+
+MYSQL_STMT *mysql_stmt_init(MYSQL *mysql);
+int mysql_stmt_prepare(MYSQL_STMT *stmt, const char *query, unsigned long length);
+bool mysql_stmt_bind_param(MYSQL_STMT *stmt, MYSQL_BIND *bnd);
+int mysql_stmt_execute(MYSQL_STMT *stmt);
+unsigned int mysql_stmt_errno(MYSQL_STMT *stmt);
+const char *mysql_stmt_error(MYSQL_STMT *stmt);
+bool mysql_stmt_close(MYSQL_STMT *stmt);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mysql/mysql.h"
+
+//替身的行为：连接总是成功、表为空；写入(语句执行和普通查询)阻塞MYSQL_STUB_LATENCY_US微秒，模拟一次数据库往返
+struct st_mysql
+{
+    int unused;
+};
+struct st_mysql_stmt
+{
+    int unused;
+};
+struct st_mysql_res
+{
+    int unused;
+};
+
+static void stub_delay()
+{
+    static int latency_us = -1;
+    if (latency_us < 0)
+    {
+        const char *env = getenv("MYSQL_STUB_LATENCY_US");
+        latency_us = env ? atoi(env) : 0;
+    }
+    if (latency_us > 0)
+        usleep(latency_us);
+}
+
+MYSQL *mysql_init(MYSQL *mysql)
+{
+    return mysql ? mysql : new st_mysql();
+}
+
+MYSQL *mysql_real_connect(MYSQL *mysql, const char *, const char *, const char *, const char *, unsigned int,
+                          const char *, unsigned long)
+{
+    return mysql;
+}
+
+int mysql_options(MYSQL *, enum mysql_option, const void *)
+{
+    return 0;
+}
+
+void mysql_close(MYSQL *mysql)
+{
+    delete mysql;
+}
+
+int mysql_ping(MYSQL *)
+{
+    return 0;
+}
+
+const char *mysql_error(MYSQL *)
+{
+    return "";
+}
+
+int mysql_get_socket(const MYSQL *)
+{
+    return -1;
+}
+
+int mysql_query(MYSQL *, const char *)
+{
+    return 0;
+}
+
+int mysql_real_query(MYSQL *, const char *, unsigned long)
+{
+    stub_delay();
+    return 0;
+}
+
+unsigned long mysql_real_escape_string(MYSQL *, char *to, const char *from, unsigned long length)
+{
+    memcpy(to, from, length);
+    to[length] = '\0';
+    return length;
+}
+
+MYSQL_RES *mysql_store_result(MYSQL *)
+{
+    return new st_mysql_res();
+}
+
+MYSQL_ROW mysql_fetch_row(MYSQL_RES *)
+{
+    return NULL;
+}
+
+void mysql_free_result(MYSQL_RES *result)
+{
+    delete result;
+}
+
+MYSQL_STMT *mysql_stmt_init(MYSQL *)
+{
+    return new st_mysql_stmt();
+}
+
+int mysql_stmt_prepare(MYSQL_STMT *, const char *, unsigned long)
+{
+    return 0;
+}
+
+bool mysql_stmt_bind_param(MYSQL_STMT *, MYSQL_BIND *)
+{
+    return false;
+}
+
+int mysql_stmt_execute(MYSQL_STMT *)
+{
+    stub_delay();
+    return 0;
+}
+
+unsigned int mysql_stmt_errno(MYSQL_STMT *)
+{
+    return 0;
+}
+
+const char *mysql_stmt_error(MYSQL_STMT *)
+{
+    return "";
+}
+
+bool mysql_stmt_close(MYSQL_STMT *stmt)
+{
+    delete stmt;
+    return false;
+}
@@ -0,0 +1,28 @@
+#!/bin/bash
+# 静态资源吞吐与数据库连接池大小无关：
+# 分别以不同的 -s(sql_num) 启动服务器，线程数固定且大于连接数，用webbench压测静态页面，
+# 各组结果应当相近。需要在项目根目录下已编译好server，且数据库可连接。
+#
+# 用法: ./test_pressure/static_sql_num.sh [线程数] [客户端数] [秒数]
+
+THREADS=${1:-16}
+CLIENTS=${2:-1000}
+SECONDS_=${3:-10}
+PORT=9916
+
+cd "$(dirname "$0")/.." || exit 1
+WEBBENCH=./test_pressure/webbench-1.5/webbench
+if [ ! -x ./server ] || [ ! -x $WEBBENCH ]; then
+    echo "need ./server and $WEBBENCH"
+    exit 1
+fi
+
+for SQL_NUM in 1 8 ${THREADS}; do
+    ./server -p $PORT -s $SQL_NUM -t $THREADS -c 1 -a 0 > /dev/null 2>&1 &
+    PID=$!
+    sleep 1
+    RESULT=$($WEBBENCH -c $CLIENTS -t $SECONDS_ http://127.0.0.1:$PORT/judge.html 2>/dev/null | grep Speed)
+    echo "sql_num=$SQL_NUM thread_num=$THREADS $RESULT"
+    kill $PID
+    wait $PID 2>/dev/null
+done
@@ -0,0 +1,67 @@
+#!/bin/bash
+# 不依赖MySQL验证静态请求不占用数据库连接：
+# server_stub把MySQL后端链接到test_pressure/mysql_stub中的替身libmysqlclient，连接池、connectionRAII和预编译语句都是真实代码，
+# 每次写入在替身中阻塞MYSQL_STUB_LATENCY_US微秒。--kdf_iter 0不启用计算线程池，注册的写入在I/O工作线程上取连接。
+# 1. 只压测静态页面，管理端口上webserver_db_pool_acquires_total不得增加
+# 2. 4个连接持续注册(acquires必须增加，确认计数有效)，同时压测静态页面。注册连接数小于工作线程数(-t 8)，
+#    等待连接的只是部分工作线程，静态请求若不取连接，p99应远小于写入延迟
+# 需要在项目根目录下已编译好server_stub和loadgen(make server_stub loadgen)。
+#
+# 用法: ./test_pressure/static_sql_stub.sh [秒数] [写入延迟微秒]
+
+SECONDS_=${1:-5}
+LATENCY=${2:-100000}
+PORT=9917
+ADMIN_PORT=9918
+
+cd "$(dirname "$0")/.." || exit 1
+if [ ! -x ./server_stub ] || [ ! -x ./loadgen ]; then
+    echo "need ./server_stub and ./loadgen"
+    exit 1
+fi
+
+acquires() {
+    curl -s http://127.0.0.1:$ADMIN_PORT/metrics | grep '^webserver_db_pool_acquires_total ' | cut -d' ' -f2
+}
+
+MYSQL_STUB_LATENCY_US=$LATENCY ./server_stub -p $PORT --admin_port $ADMIN_PORT --store mysql --kdf_iter 0 \
+    -s 1 -t 8 -c 1 -a 0 > /dev/null 2>&1 &
+PID=$!
+sleep 1
+
+FAIL=0
+A0=$(acquires)
+GET=$(./loadgen -c 4 -t 1 -d $SECONDS_ http://127.0.0.1:$PORT/judge.html)
+A1=$(acquires)
+GET_RPS=$(echo "$GET" | grep -o '"rps": [0-9.]*' | cut -d' ' -f2)
+echo "static only: static_rps=$GET_RPS acquires $A0 -> $A1"
+if [ -z "$A0" ] || [ "$A0" != "$A1" ]; then
+    echo "FAIL: static requests acquired database connections"
+    FAIL=1
+fi
+
+./loadgen -c 4 -t 1 -d $SECONDS_ -w register:100 http://127.0.0.1:$PORT/ > /tmp/static_sql_reg.$$ &
+REG=$!
+GET=$(./loadgen -c 4 -t 1 -d $SECONDS_ http://127.0.0.1:$PORT/judge.html)
+wait $REG
+A2=$(acquires)
+kill $PID
+wait $PID 2>/dev/null
+
+REG_RPS=$(grep -o '"rps": [0-9.]*' /tmp/static_sql_reg.$$ | cut -d' ' -f2)
+GET_P99=$(echo "$GET" | grep -o '"p99": [0-9]*' | cut -d' ' -f2)
+rm -f /tmp/static_sql_reg.$$
+echo "with register: register_rps=$REG_RPS static_p99_us=$GET_P99 acquires $A1 -> $A2"
+if [ -z "$A2" ] || [ "$A2" -le "$A1" ]; then
+    echo "FAIL: registrations did not go through the connection pool"
+    FAIL=1
+fi
+if [ -z "$GET_P99" ] || [ "$GET_P99" -ge "$LATENCY" ]; then
+    echo "FAIL: static requests waited for a database connection"
+    FAIL=1
+fi
+
+if [ $FAIL -ne 0 ]; then
+    exit 1
+fi
+echo "PASS: static requests do not use database connections"
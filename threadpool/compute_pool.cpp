@@ -0,0 +1,117 @@
+#include <unistd.h>
+#include <stdint.h>
+#include <exception>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include "compute_pool.h"
+
+compute_pool::compute_pool(int thread_number, int max_tasks)
+    : m_thread_number(thread_number), m_max_tasks(max_tasks), m_threads(NULL), m_stop(false)
+{
+    if (thread_number <= 0 || max_tasks <= 0)
+        throw std::exception();
+    m_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_done_fd < 0)
+        throw std::exception();
+    m_threads = new pthread_t[m_thread_number];
+    for (int i = 0; i < thread_number; ++i)
+    {
+        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
+        {
+            m_thread_number = i;
+            throw std::exception();
+        }
+    }
+}
+
+compute_pool::~compute_pool()
+{
+    m_lock.lock();
+    m_stop = true;
+    m_lock.unlock();
+    for (int i = 0; i < m_thread_number; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_threads[i], NULL);
+    delete[] m_threads;
+    close(m_done_fd);
+
+    //还没交回主线程的结果在这里回调，done负责释放arg
+    for (std::list<task>::iterator it = m_done.begin(); it != m_done.end(); ++it)
+        it->done(it->arg);
+}
+
+void compute_pool::attach(int epollfd)
+{
+    epoll_event event;
+    event.data.fd = m_done_fd;
+    event.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, m_done_fd, &event);
+}
+
+bool compute_pool::submit(compute_fn work, compute_fn done, void *arg)
+{
+    task t = {work, done, arg};
+    m_lock.lock();
+    if (m_stop || (int)m_queue.size() >= m_max_tasks)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    m_queue.push_back(t);
+    m_lock.unlock();
+    m_queuestat.post();
+    return true;
+}
+
+void *compute_pool::worker(void *arg)
+{
+    compute_pool *pool = (compute_pool *)arg;
+    pool->run();
+    return NULL;
+}
+
+void compute_pool::run()
+{
+    while (true)
+    {
+        m_queuestat.wait();
+        m_lock.lock();
+        //停止时先算完队列中的任务，每个任务都要经done释放
+        if (m_queue.empty())
+        {
+            bool stop = m_stop;
+            m_lock.unlock();
+            if (stop)
+                break;
+            continue;
+        }
+        task t = m_queue.front();
+        m_queue.pop_front();
+        m_lock.unlock();
+
+        t.work(t.arg);
+
+        m_lock.lock();
+        m_done.push_back(t);
+        m_lock.unlock();
+        uint64_t one = 1;
+        ssize_t ret = write(m_done_fd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+void compute_pool::handle_event(int fd, unsigned int events)
+{
+    uint64_t count;
+    ssize_t ret = read(m_done_fd, &count, sizeof(count));
+    (void)ret;
+
+    std::list<task> done;
+    m_lock.lock();
+    done.swap(m_done);
+    m_lock.unlock();
+
+    for (std::list<task>::iterator it = done.begin(); it != done.end(); ++it)
+        it->done(it->arg);
+}
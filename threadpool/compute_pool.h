@@ -0,0 +1,55 @@
+#ifndef COMPUTE_POOL_H
+#define COMPUTE_POOL_H
+
+#include <list>
+#include <pthread.h>
+#include "../lock/locker.h"
+
+typedef void (*compute_fn)(void *arg);
+
+/*************************************************************
+*计算线程池，用于口令哈希这类耗CPU的任务，与处理I/O的threadpool分开，
+*避免几毫秒的计算占住I/O工作线程
+*work在计算线程中执行，完成后done经eventfd交回主线程执行
+*队列有上限，满时submit返回false，由调用方拒绝请求
+*析构时计算线程处理完队列中的任务再退出，未交回主线程的done在析构线程中执行
+**************************************************************/
+class compute_pool
+{
+public:
+    compute_pool(int thread_number, int max_tasks);
+    ~compute_pool();
+
+    //将完成通知用的eventfd注册到主线程的epoll
+    void attach(int epollfd);
+
+    //任意线程调用，队列已满返回false
+    bool submit(compute_fn work, compute_fn done, void *arg);
+
+    bool owns(int fd) const { return fd >= 0 && fd == m_done_fd; }
+    //主线程调用：执行已完成任务的done
+    void handle_event(int fd, unsigned int events);
+
+private:
+    struct task
+    {
+        compute_fn work;
+        compute_fn done;
+        void *arg;
+    };
+
+    static void *worker(void *arg);
+    void run();
+
+    int m_thread_number;
+    int m_max_tasks;
+    pthread_t *m_threads;
+    std::list<task> m_queue; //等待计算的任务
+    std::list<task> m_done;  //已计算完，等待主线程回调
+    locker m_lock;           //保护m_queue、m_done和m_stop
+    sem m_queuestat;         //待计算的任务数
+    bool m_stop;
+    int m_done_fd;
+};
+
+#endif
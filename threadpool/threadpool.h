@@ -3,45 +3,96 @@
 
 #include <list>
 #include <cstdio>
+#include <atomic>
 #include <exception>
 #include <pthread.h>
+#include <time.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+
+//准入控制计数，主线程和工作线程都会更新
+struct admission_stats
+{
+    std::atomic<unsigned long long> admitted;   //进入队列的请求
+    std::atomic<unsigned long long> shed_full;  //队列满被拒绝
+    std::atomic<unsigned long long> shed_codel; //排队时间超标被丢弃
+};
 
 template <typename T>
 class threadpool
 {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*codel_target_ms是排队时间的目标值，一个codel_interval_ms内排队时间都超过它即为过载，为0时只按队列长度拒绝*/
+    threadpool(int actor_model, int thread_number = 8, int max_request = 10000,
+               int codel_target_ms = 0, int codel_interval_ms = 100);
+    //工作线程处理完队列中剩余的请求后退出，析构时等待它们结束
     ~threadpool();
+    //队列满时返回false，由调用方直接回复503
     bool append(T *request, int state);
     bool append_p(T *request);
+    const admission_stats &stats() const { return m_stats; }
+    //当前排队的请求数
+    int queue_size()
+    {
+        m_queuelocker.lock();
+        int size = m_workqueue.size();
+        m_queuelocker.unlock();
+        return size;
+    }
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
     static void *worker(void *arg);
     void run();
+    //CoDel：出队时根据排队时间判断是否丢弃，在持有队列锁时调用
+    bool codel_drop(long long sojourn, long long now);
+    static long long now_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
 
 private:
+    struct work_item
+    {
+        T *request;
+        long long enqueue_us; //入队时间，用于计算排队时间
+    };
+
     int m_thread_number;        //线程池中的线程数
-    int m_max_requests;         //请求队列中允许的最大请求数
+    size_t m_max_requests;      //请求队列中允许的最大请求数
     pthread_t *m_threads;       //描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue; //请求队列
+    std::list<work_item> m_workqueue; //请求队列
     locker m_queuelocker;       //保护请求队列的互斥锁
     sem m_queuestat;            //信号量，是否有任务需要处理
-    connection_pool *m_connPool;  //数据库
+    bool m_stop;                //由m_queuelocker保护
     int m_actor_model;          //模型切换
+    admission_stats m_stats;
+
+    //CoDel状态
+    long long m_codel_target;   //微秒，0为关闭
+    long long m_codel_interval; //微秒
+    long long m_interval_end;   //当前统计窗口结束时刻
+    long long m_min_sojourn;    //当前窗口内的最小排队时间
+    bool m_overloaded;          //上一个窗口的最小排队时间超过target
 };
 template <typename T>
-threadpool<T>::threadpool( int actor_model, connection_pool *connPool, 
-                        int thread_number, int max_requests) : 
+threadpool<T>::threadpool( int actor_model, 
+                        int thread_number, int max_requests,
+                        int codel_target_ms, int codel_interval_ms) : 
                         m_actor_model(actor_model),m_thread_number(thread_number), 
-                        m_max_requests(max_requests), m_threads(NULL),
-                        m_connPool(connPool)
+                        m_max_requests(max_requests), m_threads(NULL), m_stop(false),
+                        m_codel_target(codel_target_ms * 1000LL), m_codel_interval(codel_interval_ms * 1000LL),
+                        m_interval_end(0), m_min_sojourn(0), m_overloaded(false)
 {
-    if (thread_number <= 0 || max_requests <= 0)
+    if (thread_number <= 0 || max_requests <= 0 || codel_interval_ms <= 0)
         throw std::exception();
+    m_stats.admitted = 0;
+    m_stats.shed_full = 0;
+    m_stats.shed_codel = 0;
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
         throw std::exception();
@@ -52,16 +103,18 @@ threadpool<T>::threadpool( int actor_model, connection_pool *connPool,
             delete[] m_threads;
             throw std::exception();
         }
-        if (pthread_detach(m_threads[i]))
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
     }
 }
 template <typename T>
 threadpool<T>::~threadpool()
 {
+    m_queuelocker.lock();
+    m_stop = true;
+    m_queuelocker.unlock();
+    for (int i = 0; i < m_thread_number; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_threads[i], NULL);
     delete[] m_threads;
 }
 template <typename T>
@@ -71,11 +124,14 @@ bool threadpool<T>::append(T *request, int state)
     if (m_workqueue.size() >= m_max_requests)
     {
         m_queuelocker.unlock();
+        m_stats.shed_full.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
     request->m_state = state;
-    m_workqueue.push_back(request);
+    work_item item = {request, now_us()};
+    m_workqueue.push_back(item);
     m_queuelocker.unlock();
+    m_stats.admitted.fetch_add(1, std::memory_order_relaxed);
     m_queuestat.post();
     return true;
 }
@@ -86,14 +142,35 @@ bool threadpool<T>::append_p(T *request)
     if (m_workqueue.size() >= m_max_requests)
     {
         m_queuelocker.unlock();
+        m_stats.shed_full.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
-    m_workqueue.push_back(request);
+    work_item item = {request, now_us()};
+    m_workqueue.push_back(item);
     m_queuelocker.unlock();
+    m_stats.admitted.fetch_add(1, std::memory_order_relaxed);
     m_queuestat.post();
     return true;
 }
 
+//请求队列上的CoDel：每个interval统计一次最小排队时间，最小值都超过target说明是持续积压而不是突发，
+//此时排队超过2倍target的请求直接丢弃，被接纳请求的排队时间因此有上界；积压消退后下一个interval恢复
+template <typename T>
+bool threadpool<T>::codel_drop(long long sojourn, long long now)
+{
+    if (0 == m_codel_target)
+        return false;
+    if (now >= m_interval_end)
+    {
+        m_overloaded = m_interval_end > 0 && m_min_sojourn > m_codel_target;
+        m_interval_end = now + m_codel_interval;
+        m_min_sojourn = sojourn;
+    }
+    else if (sojourn < m_min_sojourn)
+        m_min_sojourn = sojourn;
+    return m_overloaded && sojourn > 2 * m_codel_target;
+}
+
 template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
@@ -110,46 +187,62 @@ void threadpool<T>::run()
         m_queuelocker.lock();
         if (m_workqueue.empty())
         {
+            //停止时先把已入队的请求处理完
+            bool stop = m_stop;
             m_queuelocker.unlock();
+            if (stop)
+                break;
             continue;
         }
-        T *request = m_workqueue.front();
+        work_item item = m_workqueue.front();
         m_workqueue.pop_front();
+        long long now = now_us();
+        //只丢弃新请求(读事件)，已经在发送的响应不丢
+        bool drop = codel_drop(now - item.enqueue_us, now) && (1 != m_actor_model || 0 == item.request->m_state);
         m_queuelocker.unlock();
+        metrics::record(H_QUEUE_WAIT, now - item.enqueue_us);
+        if (item.request)
+        {
+            WS_PROBE2(queue, item.request->get_conn_id(), now - item.enqueue_us);
+            TRACE_SPAN(T_QUEUE, item.request->get_conn_id(), item.enqueue_us, now);
+        }
+        T *request = item.request;
         if (!request)
             continue;
+        if (drop)
+        {
+            m_stats.shed_codel.fetch_add(1, std::memory_order_relaxed);
+            //reactor模式下请求还没读，读出来再回503，避免关闭时接收缓冲区有数据导致RST把503冲掉
+            if (1 == m_actor_model)
+                request->read_once();
+            request->shed();
+            if (1 == m_actor_model)
+                request->improv.store(1, std::memory_order_release);
+            continue;
+        }
         if (1 == m_actor_model)
         {
             if (0 == request->m_state)
             {
                 if (request->read_once())
-                {
-                    request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
-                }
                 else
-                {
-                    request->improv = 1;
                     request->timer_flag = 1;
-                }
             }
             else
             {
-                if (request->write())
-                {
-                    request->improv = 1;
-                }
-                else
-                {
-                    request->improv = 1;
+                if (!request->write())
                     request->timer_flag = 1;
-                }
+                //流水线中的下一个请求已经读入，接着处理
+                else if (request->pipelined())
+                    request->process();
             }
+            //读写和处理都结束后才发布improv，主线程随后按连接此时的阶段调整定时器，不会与本线程同时访问连接
+            request->improv.store(1, std::memory_order_release);
         }
         else
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
+            //数据库连接由需要它的处理函数按需获取，静态资源请求不再占用连接
             request->process();
         }
     }
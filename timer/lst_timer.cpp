@@ -5,6 +5,7 @@ sort_timer_lst::sort_timer_lst()
 {
     head = NULL;
     tail = NULL;
+    m_size = 0;
 }
 sort_timer_lst::~sort_timer_lst()
 {
@@ -17,6 +18,23 @@ sort_timer_lst::~sort_timer_lst()
     }
 }
 
+//添加定时器：链表为空或timer最早到期时直接放到表头，否则从头节点之后找位置
+void sort_timer_lst::add_timer(util_timer *timer){
+    if(!timer) return;
+    m_size.fetch_add(1, std::memory_order_relaxed);
+    if(!head){
+        head = tail = timer;
+        return;
+    }
+    if(timer->expire < head->expire){
+        timer->next = head;
+        head->prev = timer;
+        head = timer;
+        return;
+    }
+    add_timer(timer, head);
+}
+
 //添加定时器
 void sort_timer_lst::add_timer(util_timer *timer, util_timer *lst_head){
     util_timer *prev = lst_head;
@@ -81,10 +99,31 @@ void sort_timer_lst::adjust_timer(util_timer *timer){
     }
 }
 
+//移动定时器：不同阶段的超时时长不同，超时时间可能提前，adjust_timer只能往后调
+void sort_timer_lst::move_timer(util_timer *timer){
+    if(!timer) return;
+
+    //将timer从链表中取出
+    if(timer->prev)
+        timer->prev->next = timer->next;
+    else
+        head = timer->next;
+    if(timer->next)
+        timer->next->prev = timer->prev;
+    else
+        tail = timer->prev;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+
+    add_timer(timer);
+}
+
 //删除定时器
 void sort_timer_lst::del_timer(util_timer *timer){
     //空节点直接返回
     if(!timer) return;
+    m_size.fetch_sub(1, std::memory_order_relaxed);
 
     //链表中只有一个定时器节点
     if((timer == head) && (timer == tail)){
@@ -143,6 +182,7 @@ void sort_timer_lst::tick()
         tmp->cb_func(tmp->user_data);
 
         //将处理后的定时器从链表容器中删除，并重置头结点
+        m_size.fetch_sub(1, std::memory_order_relaxed);
         head = tmp->next;
         if (head)
         {
@@ -238,8 +278,9 @@ int Utils::u_epollfd = 0;
 class Utils;
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
+    //连接只在这里关闭，fd、连接计数和每IP连接数由close_conn统一释放一次
+    user_data->conn->close_conn();
+    //定时器随后由调用方删除，清空后users_timer中非空的timer即为仍打开的连接
+    user_data->timer = NULL;
 }
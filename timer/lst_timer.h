@@ -22,9 +22,11 @@
 #include <sys/uio.h>
 
 #include <time.h>
+#include <atomic>
 #include "../log/log.h"
 
 class util_timer;
+class http_conn;
 
 //连接资源
 struct client_data
@@ -32,6 +34,7 @@ struct client_data
     sockaddr_in address;
     int sockfd;
     util_timer *timer;
+    http_conn *conn; //超时或出错时经它关闭连接
 };
 
 //定时器节点：双向升序链表的节点
@@ -57,16 +60,21 @@ public:
     void add_timer(util_timer *timer);//添加定时器
 
     void adjust_timer(util_timer *timer);//通过递归调整定时器节点位置
+
+    void move_timer(util_timer *timer);//超时时间可能提前时使用：摘下后重新插入
     
     void del_timer(util_timer *timer);//删除定时器节点
 
     void tick();//SIGALRM信号每次被触发就在信号处理函数中执行一次tick函数，以处理链表上到期的任务
+
+    int size() const { return m_size.load(std::memory_order_relaxed); }//链表上的定时器数，抓取指标时在工作线程中读取
 private:
 
     void add_timer(util_timer *timer, util_timer *lst_head);//添加新用户的定时器节点timer（while找到合适的位置插入）
 
     util_timer *head;
     util_timer *tail;
+    std::atomic<int> m_size;
 };
 
 class Utils
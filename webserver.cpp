@@ -1,4 +1,9 @@
 #include "webserver.h"
+#include "./CGImysql/mmap_store.h"
+#include "./CGImysql/mock_store.h"
+#ifndef NO_MYSQL
+#include "./CGImysql/mysql_store.h"
+#endif
 
 WebServer::WebServer()
 {
@@ -14,34 +19,86 @@ WebServer::WebServer()
     strcat(m_root, root);
 
     //定时器
-    users_timer = new client_data[MAX_FD];
+    users_timer = new client_data[MAX_FD]();
+
+    m_store = NULL;
+    m_kdf_pool = NULL;
+    m_limiter = NULL;
 }
 
 WebServer::~WebServer()
 {
     close(m_epollfd);
     close(m_listenfd);
+    if (m_adminfd >= 0)
+        close(m_adminfd);
     close(m_pipefd[1]);
     close(m_pipefd[0]);
+    //先停工作线程，再释放存储(异步写库的剩余任务在析构中完成，回调要访问users)，最后释放连接
+    delete m_pool;
+    delete m_kdf_pool;
+    delete m_store;
     delete[] users;
     delete[] users_timer;
-    delete m_pool;
+    delete m_limiter;
 }
 
-void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+void WebServer::init(const Config &config, string user, string passWord, string databaseName)
 {
-    m_port = port;
+    m_port = config.PORT;
     m_user = user;
     m_passWord = passWord;
     m_databaseName = databaseName;
-    m_sql_num = sql_num;
-    m_thread_num = thread_num;
-    m_log_write = log_write;
-    m_OPT_LINGER = opt_linger;
-    m_TRIGMode = trigmode;
-    m_close_log = close_log;
-    m_actormodel = actor_model;
+    m_sql_num = config.sql_num;
+    m_sql_min = config.sql_min;
+    m_sql_idle = config.sql_idle;
+    m_sql_timeout = config.sql_timeout;
+    m_thread_num = config.thread_num;
+    m_log_write = config.LOGWrite;
+    m_OPT_LINGER = config.OPT_LINGER;
+    m_TRIGMode = config.TRIGMode;
+    m_close_log = config.close_log;
+    m_actormodel = config.actor_model;
+    m_access_sample = config.access_sample;
+    m_log_compress = config.log_compress;
+    m_log_max_files = config.log_max_files;
+    m_log_max_size = config.log_max_size;
+    m_async_sql_num = config.async_sql_num;
+    m_sql_batch = config.sql_batch;
+    m_sql_batch_delay = config.sql_batch_delay;
+    m_kdf_iter = config.kdf_iter;
+    m_kdf_threads = config.kdf_threads;
+    m_kdf_queue = config.kdf_queue;
+    m_store_type = config.store;
+    m_store_file = config.store_file;
+    m_store_latency = config.store_latency;
+    m_max_body = config.max_body;
+    m_upload_dir = config.upload_dir;
+    m_header_timeout = config.header_timeout;
+    m_body_timeout = config.body_timeout;
+    m_write_timeout = config.write_timeout;
+    m_keepalive_timeout = config.keepalive_timeout;
+    m_max_requests = config.max_requests;
+    m_backlog = config.backlog;
+    m_accept_batch = config.accept_batch > 0 ? config.accept_batch : 1;
+    m_accept_pending = false;
+    m_queue_max = config.queue_max;
+    m_codel_target = config.codel_target;
+    m_codel_interval = config.codel_interval;
+    m_last_shed = 0;
+    m_limit_conf.req_rate = config.ip_rate;
+    m_limit_conf.req_burst = config.ip_burst > 0 ? config.ip_burst : (int)config.ip_rate;
+    m_limit_conf.conn_rate = config.ip_conn_rate;
+    m_limit_conf.conn_burst = config.ip_conn_burst > 0 ? config.ip_conn_burst : (int)config.ip_conn_rate;
+    m_limit_conf.max_conns = config.ip_max_conns;
+    m_limit_conf.table_size = config.ip_table;
+    m_last_limited = 0;
+    m_admin_port = config.admin_port;
+    m_adminfd = -1;
+    m_drain_timeout = config.drain_timeout;
+    m_reuse_port = config.reuse_port;
+    m_draining = false;
+    m_drain_deadline = 0;
 }
 
 void WebServer::trig_mode()
@@ -77,27 +134,109 @@ void WebServer::log_write()
     if (0 == m_close_log)
     {
         //初始化日志
+        long long max_bytes = (long long)m_log_max_size * 1024 * 1024;
         if (1 == m_log_write)
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800,
+                                      m_log_compress, m_log_max_files, max_bytes);
         else
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0,
+                                      m_log_compress, m_log_max_files, max_bytes);
+
+        //访问日志采样率
+        http_conn::m_access_sample = m_access_sample;
     }
 }
 
 void WebServer::sql_pool()
 {
-    //初始化数据库连接池
-    m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    if ("mmap" == m_store_type)
+    {
+        //本地文件哈希表，不依赖数据库
+        mmap_store *store = new mmap_store;
+        if (!store->init(m_store_file.c_str(), m_close_log))
+        {
+            LOG_ERROR("%s", "user store init failure");
+            exit(1);
+        }
+        m_store = store;
+    }
+    else if ("mock" == m_store_type)
+    {
+        //内存替身，注入固定延迟
+        m_store = new mock_store(m_store_latency);
+    }
+#ifndef NO_MYSQL
+    else if ("mysql" == m_store_type)
+    {
+        //初始化数据库连接池
+        connection_pool *connPool = connection_pool::GetInstance();
+        connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_min, m_sql_num, m_close_log,
+                       m_sql_idle, m_sql_timeout);
+
+        //异步数据库客户端，注册请求交给主线程的事件循环执行
+        async_sql *async = NULL;
+        if (m_async_sql_num > 0)
+        {
+            async = new async_sql;
+            if (!async->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_async_sql_num, m_close_log))
+            {
+                LOG_WARN("%s", "async sql unavailable, fall back to connection pool");
+                delete async;
+                async = NULL;
+            }
+        }
 
-    //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+        //注册合并写库，后台线程攒批后用一条多行INSERT写入
+        sql_batch *batch = NULL;
+        if (m_sql_batch > 0)
+        {
+            batch = new sql_batch;
+            if (!batch->init(connPool, m_sql_batch, m_sql_batch_delay, m_close_log))
+            {
+                LOG_WARN("%s", "sql batch unavailable, write registrations one by one");
+                delete batch;
+                batch = NULL;
+            }
+        }
+
+        //初始化数据库读取表
+        mysql_store *store = new mysql_store(connPool, async, batch, m_close_log);
+        if (!store->load())
+            LOG_ERROR("%s", "load users from MySQL failure");
+        m_store = store;
+    }
+#endif
+    else
+    {
+        LOG_ERROR("unknown user store: %s", m_store_type.c_str());
+        exit(1);
+    }
+    http_conn::m_store = m_store;
 }
 
 void WebServer::thread_pool()
 {
     //线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num, m_queue_max, m_codel_target, m_codel_interval);
+
+    //口令哈希单独使用计算线程池，不占用I/O工作线程
+    http_conn::m_kdf_iter = m_kdf_iter;
+    if (m_kdf_iter > 0)
+    {
+        m_kdf_pool = new compute_pool(m_kdf_threads, m_kdf_queue);
+        http_conn::m_kdf_pool = m_kdf_pool;
+    }
+
+    //消息体上限和上传目录，工作线程解析消息体时使用
+    http_conn::m_max_body = (long long)m_max_body * 1024 * 1024;
+    http_conn::m_upload_dir = m_upload_dir;
+
+    //各阶段的超时时长
+    http_conn::m_header_timeout = m_header_timeout;
+    http_conn::m_body_timeout = m_body_timeout;
+    http_conn::m_write_timeout = m_write_timeout;
+    http_conn::m_keepalive_timeout = m_keepalive_timeout;
+    http_conn::m_max_requests = m_max_requests;
 }
 
 void WebServer::eventListen()
@@ -127,12 +266,24 @@ void WebServer::eventListen()
 
     int flag = 1;
     setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    //滚动重启时新进程先绑定同一端口，旧进程排空期间新连接由新进程接收
+    if (m_reuse_port)
+        setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
     ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
-    ret = listen(m_listenfd, 5);
+    //backlog太小时突发连接会溢出SYN/accept队列，客户端要等1~3秒重传
+    int backlog = m_backlog > 0 ? m_backlog : somaxconn();
+    ret = listen(m_listenfd, backlog);
     assert(ret >= 0);
+    LOG_INFO("listen backlog %d, accept batch %d", backlog, m_accept_batch);
 
-    utils.init(TIMESLOT);
+    //超时设得比TIMESLOT短时相应缩短检查间隔，否则实际超时会被拖到下一个TIMESLOT
+    m_timeslot = TIMESLOT;
+    int timeouts[] = {m_header_timeout, m_body_timeout, m_write_timeout, m_keepalive_timeout};
+    for (int i = 0; i < 4; ++i)
+        if (timeouts[i] > 0 && timeouts[i] < m_timeslot)
+            m_timeslot = timeouts[i];
+    utils.init(m_timeslot);
 
     //epoll创建内核事件表
     epoll_event events[MAX_EVENT_NUMBER];
@@ -142,6 +293,26 @@ void WebServer::eventListen()
     utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
     http_conn::m_epollfd = m_epollfd;
 
+    //管理端口，与业务端口共用事件循环和连接对象，按端口区分可访问的路径
+    if (m_admin_port > 0)
+    {
+        m_adminfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        assert(m_adminfd >= 0);
+        setsockopt(m_adminfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+        address.sin_port = htons(m_admin_port);
+        ret = bind(m_adminfd, (struct sockaddr *)&address, sizeof(address));
+        assert(ret >= 0);
+        ret = listen(m_adminfd, 16);
+        assert(ret >= 0);
+        utils.addfd(m_epollfd, m_adminfd, false, 0);
+        metrics::add_collector(collect_metrics, this);
+        LOG_INFO("admin port %d", m_admin_port);
+    }
+
+    m_store->attach(m_epollfd);
+    if (m_kdf_pool)
+        m_kdf_pool->attach(m_epollfd);
+
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
     assert(ret != -1);
     utils.setnonblocking(m_pipefd[1]);
@@ -151,37 +322,145 @@ void WebServer::eventListen()
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
 
-    alarm(TIMESLOT);
+    alarm(m_timeslot);
 
     //工具类,信号和描述符基础操作
     Utils::u_pipefd = m_pipefd;
     Utils::u_epollfd = m_epollfd;
 }
 
+//系统允许的最大backlog，读不到时用SOMAXCONN
+int WebServer::somaxconn()
+{
+    int value = SOMAXCONN;
+    FILE *fp = fopen("/proc/sys/net/core/somaxconn", "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%d", &value) != 1 || value <= 0)
+            value = SOMAXCONN;
+        fclose(fp);
+    }
+    return value;
+}
+
+void WebServer::rate_limit()
+{
+    if (m_limit_conf.req_rate <= 0 && m_limit_conf.conn_rate <= 0 && m_limit_conf.max_conns <= 0)
+        return;
+    m_limiter = new rate_limiter;
+    if (!m_limiter->init(m_limit_conf))
+    {
+        LOG_ERROR("%s", "rate limiter init failed");
+        exit(1);
+    }
+    http_conn::m_limiter = m_limiter;
+}
+
+//过载统计：有新的请求被拒绝时记一条日志
+void WebServer::log_admission()
+{
+    const admission_stats &stats = m_pool->stats();
+    unsigned long long full = stats.shed_full.load(std::memory_order_relaxed);
+    unsigned long long codel = stats.shed_codel.load(std::memory_order_relaxed);
+    if (full + codel != m_last_shed)
+    {
+        m_last_shed = full + codel;
+        LOG_WARN("overload: admitted %llu, shed %llu (queue full %llu, codel %llu)",
+                 stats.admitted.load(std::memory_order_relaxed), full + codel, full, codel);
+    }
+
+    if (m_limiter)
+    {
+        unsigned long long conns = m_limiter->rejected_conns();
+        unsigned long long reqs = m_limiter->rejected_reqs();
+        if (conns + reqs != m_last_limited)
+        {
+            m_last_limited = conns + reqs;
+            LOG_WARN("rate limit: rejected %llu connections, %llu requests", conns, reqs);
+        }
+    }
+}
+
+//抓取/metrics时在工作线程中调用，只读原子量或自带锁的统计
+void WebServer::collect_metrics(void *arg, string &out)
+{
+    WebServer *server = (WebServer *)arg;
+    metrics::gauge(out, "webserver_connections", "Open client connections", http_conn::m_user_count.load());
+    metrics::gauge(out, "webserver_timers", "Connection timers in the timer list", server->utils.m_timer_lst.size());
+    metrics::gauge(out, "webserver_queue_depth", "Requests waiting in the worker queue", server->m_pool->queue_size());
+
+    const admission_stats &stats = server->m_pool->stats();
+    metrics::counter(out, "webserver_admitted_total", "Requests admitted to the worker queue",
+                     stats.admitted.load(std::memory_order_relaxed));
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "# HELP webserver_shed_total Requests answered with 503 by admission control\n"
+             "# TYPE webserver_shed_total counter\n"
+             "webserver_shed_total{reason=\"queue_full\"} %llu\n"
+             "webserver_shed_total{reason=\"codel\"} %llu\n",
+             stats.shed_full.load(std::memory_order_relaxed), stats.shed_codel.load(std::memory_order_relaxed));
+    out += buf;
+    if (server->m_limiter)
+    {
+        snprintf(buf, sizeof(buf),
+                 "# HELP webserver_rate_limited_total Connections and requests rejected by the per-IP limiter\n"
+                 "# TYPE webserver_rate_limited_total counter\n"
+                 "webserver_rate_limited_total{kind=\"connection\"} %llu\n"
+                 "webserver_rate_limited_total{kind=\"request\"} %llu\n",
+                 server->m_limiter->rejected_conns(), server->m_limiter->rejected_reqs());
+        out += buf;
+    }
+
+#ifndef NO_MYSQL
+    if ("mysql" == server->m_store_type)
+    {
+        pool_stats pool;
+        connection_pool::GetInstance()->GetStats(pool);
+        metrics::gauge(out, "webserver_db_pool_in_use", "Database connections in use", pool.in_use);
+        metrics::gauge(out, "webserver_db_pool_idle", "Idle database connections", pool.idle);
+        metrics::gauge(out, "webserver_db_pool_utilization", "In-use database connections over the pool maximum",
+                       server->m_sql_num > 0 ? (double)pool.in_use / server->m_sql_num : 0);
+        metrics::counter(out, "webserver_db_pool_acquires_total", "Successful connection acquisitions", pool.acquires);
+        metrics::counter(out, "webserver_db_pool_timeouts_total", "Acquisitions that timed out", pool.timeouts);
+    }
+#endif
+}
+
 void WebServer::timer(int connfd, struct sockaddr_in client_address)
 {
+    metrics::inc(M_CONN_ACCEPTED);
     users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
 
     //初始化client_data数据
     //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].conn = users + connfd;
     util_timer *timer = new util_timer;
     timer->user_data = &users_timer[connfd];
     timer->cb_func = cb_func;
     time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    timer->expire = users[connfd].expire_at(cur);
     users_timer[connfd].timer = timer;
     utils.m_timer_lst.add_timer(timer);
 }
 
-//若有数据传输，则将定时器往后延迟3个单位
-//并对新的定时器在链表上的位置进行调整
+//若有数据传输，按连接所处阶段重新计算超时时间
+//并对新的定时器在链表上的位置进行调整，阶段变化时超时时间可能提前
 void WebServer::adjust_timer(util_timer *timer)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    utils.m_timer_lst.adjust_timer(timer);
+    adjust_timer(timer, users[timer->user_data->sockfd].expire_at(time(NULL)));
+}
+
+//proactor模式下连接交给工作线程后不能再读它的状态，期限由调用方在放入请求队列之前算好
+void WebServer::adjust_timer(util_timer *timer, time_t expire)
+{
+    bool earlier = expire < timer->expire;
+    timer->expire = expire;
+    if (earlier)
+        utils.m_timer_lst.move_timer(timer);
+    else
+        utils.m_timer_lst.adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
 }
@@ -197,16 +476,23 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
     LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
 }
 
+//accept4直接得到非阻塞、exec时关闭的连接，省去两次fcntl
+//LT和ET监听模式都一轮最多取m_accept_batch个，连接风暴时已有连接的读写事件不会被饿住
+//LT模式下还有连接会再次通知；ET模式不会，取满上限时记下，本轮事件处理完后接着取
 bool WebServer::dealclientdata()
 {
     struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
-    if (0 == m_LISTENTrigmode)
+    socklen_t client_addrlength;
+    m_accept_pending = false;
+    for (int i = 0; i < m_accept_batch; ++i)
     {
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0)
         {
-            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
         if (http_conn::m_user_count >= MAX_FD)
@@ -215,30 +501,41 @@ bool WebServer::dealclientdata()
             LOG_ERROR("%s", "Internal server busy");
             return false;
         }
+        //来源IP建连过快或连接过多，回复429后直接关闭，不分配连接资源
+        if (m_limiter && !m_limiter->on_accept(client_address.sin_addr.s_addr))
+        {
+            utils.show_error(connfd, "HTTP/1.1 429 Too Many Requests\r\nRetry-After:1\r\nContent-Length:0\r\nConnection:close\r\n\r\n");
+            continue;
+        }
         timer(connfd, client_address);
     }
+    if (1 == m_LISTENTrigmode)
+        m_accept_pending = true;
+    return true;
+}
 
-    else
+//管理端口连接很少，每次只取一个；限流照常计入，关闭连接时的计数才能对上
+void WebServer::dealadminconn()
+{
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    int connfd = accept4(m_adminfd, (struct sockaddr *)&client_address, &client_addrlength,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connfd < 0)
+        return;
+    if (http_conn::m_user_count >= MAX_FD)
     {
-        while (1)
-        {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-            if (connfd < 0)
-            {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD)
-            {
-                utils.show_error(connfd, "Internal server busy");
-                LOG_ERROR("%s", "Internal server busy");
-                break;
-            }
-            timer(connfd, client_address);
-        }
-        return false;
+        utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return;
     }
-    return true;
+    if (m_limiter && !m_limiter->on_accept(client_address.sin_addr.s_addr))
+    {
+        utils.show_error(connfd, "HTTP/1.1 429 Too Many Requests\r\nRetry-After:1\r\nContent-Length:0\r\nConnection:close\r\n\r\n");
+        return;
+    }
+    timer(connfd, client_address);
+    users[connfd].set_admin(true);
 }
 
 bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
@@ -266,9 +563,13 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 timeout = true;
                 break;
             }
+            //配置了排空期限时先排空(本轮事件处理完后开始)，排空期间再次收到SIGTERM立即退出
             case SIGTERM:
             {
-                stop_server = true;
+                if (m_drain_timeout > 0 && !m_draining)
+                    m_draining = true;
+                else
+                    stop_server = true;
                 break;
             }
             }
@@ -277,31 +578,102 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
     return true;
 }
 
+//停止接受新连接，关闭空闲的长连接，其余连接处理完当前请求后随Connection: close关闭
+void WebServer::start_drain()
+{
+    m_drain_deadline = trace::now_us() + m_drain_timeout * 1000000LL;
+    http_conn::m_draining = true;
+
+    //已完成握手、还在accept队列中的连接会在关闭监听socket时被内核重置，先取出来
+    while (dealclientdata())
+        ;
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    close(m_listenfd);
+    m_listenfd = -1;
+    m_accept_pending = false;
+    if (m_adminfd >= 0)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_adminfd, 0);
+        close(m_adminfd);
+        m_adminfd = -1;
+    }
+
+    int idle = 0;
+    for (int fd = 0; fd < MAX_FD; ++fd)
+    {
+        if (users_timer[fd].timer && users[fd].idle())
+        {
+            deal_timer(users_timer[fd].timer, fd);
+            ++idle;
+        }
+    }
+    LOG_INFO("draining: closed %d idle connections, %d left, deadline %ds", idle, http_conn::m_user_count.load(),
+             m_drain_timeout);
+}
+
+//事件循环退出后：工作线程处理完已入队的请求后退出，再关闭剩余连接，最后等日志线程写完
+void WebServer::stop()
+{
+    delete m_pool;
+    m_pool = NULL;
+    //计算线程退出后，还在等哈希结果的连接一并关闭
+    delete m_kdf_pool;
+    m_kdf_pool = NULL;
+    http_conn::m_kdf_pool = NULL;
+
+    int remaining = 0;
+    for (int fd = 0; fd < MAX_FD; ++fd)
+    {
+        if (users_timer[fd].timer)
+        {
+            deal_timer(users_timer[fd].timer, fd);
+            ++remaining;
+        }
+    }
+    if (remaining > 0)
+        LOG_WARN("shutdown: closed %d connections still in progress", remaining);
+    LOG_INFO("%s", "server stopped");
+    Log::get_instance()->stop();
+}
+
 void WebServer::dealwithread(int sockfd)
 {
+    TRACE_SCOPE(T_DISPATCH, users[sockfd].get_conn_id());
     util_timer *timer = users_timer[sockfd].timer;
 
     //reactor
     if (1 == m_actormodel)
     {
-        if (timer)
+        //若监测到读事件，将该事件放入请求队列
+        //队列已满时由主线程读出请求并回复503，不能再等工作线程置improv
+        if (!m_pool->append(users + sockfd, 0))
         {
-            adjust_timer(timer);
+            if (users[sockfd].read_once())
+            {
+                users[sockfd].shed();
+                if (timer)
+                    adjust_timer(timer);
+            }
+            else
+                deal_timer(timer, sockfd);
+            return;
         }
 
-        //若监测到读事件，将该事件放入请求队列
-        m_pool->append(users + sockfd, 0);
-
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            if (1 == users[sockfd].improv.load(std::memory_order_acquire))
             {
                 if (1 == users[sockfd].timer_flag)
                 {
                     deal_timer(timer, sockfd);
                     users[sockfd].timer_flag = 0;
                 }
-                users[sockfd].improv = 0;
+                //读写之后连接所处阶段才确定，再按阶段调整定时器
+                else if (timer)
+                {
+                    adjust_timer(timer);
+                }
+                users[sockfd].improv.store(0, std::memory_order_relaxed);
                 break;
             }
         }
@@ -313,12 +685,16 @@ void WebServer::dealwithread(int sockfd)
         {
             LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
-            //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            //按读请求阶段计算期限，放入请求队列后连接归工作线程所有
+            time_t expire = users[sockfd].expire_at(time(NULL));
+
+            //若监测到读事件，将该事件放入请求队列，队列已满时直接回复503
+            if (!m_pool->append_p(users + sockfd))
+                users[sockfd].shed();
 
             if (timer)
             {
-                adjust_timer(timer);
+                adjust_timer(timer, expire);
             }
         }
         else
@@ -330,27 +706,42 @@ void WebServer::dealwithread(int sockfd)
 
 void WebServer::dealwithwrite(int sockfd)
 {
+    TRACE_SCOPE(T_DISPATCH, users[sockfd].get_conn_id());
     util_timer *timer = users_timer[sockfd].timer;
     //reactor
     if (1 == m_actormodel)
     {
-        if (timer)
+        //队列已满时响应已经生成，直接在主线程发送
+        if (!m_pool->append(users + sockfd, 1))
         {
-            adjust_timer(timer);
+            if (users[sockfd].write())
+            {
+                //流水线中的下一个请求同样没有工作线程处理，直接回复503
+                if (users[sockfd].pipelined())
+                    users[sockfd].shed();
+                if (timer)
+                    adjust_timer(timer);
+            }
+            else
+                deal_timer(timer, sockfd);
+            return;
         }
 
-        m_pool->append(users + sockfd, 1);
-
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            if (1 == users[sockfd].improv.load(std::memory_order_acquire))
             {
                 if (1 == users[sockfd].timer_flag)
                 {
                     deal_timer(timer, sockfd);
                     users[sockfd].timer_flag = 0;
                 }
-                users[sockfd].improv = 0;
+                //读写之后连接所处阶段才确定，再按阶段调整定时器
+                else if (timer)
+                {
+                    adjust_timer(timer);
+                }
+                users[sockfd].improv.store(0, std::memory_order_relaxed);
                 break;
             }
         }
@@ -362,9 +753,14 @@ void WebServer::dealwithwrite(int sockfd)
         {
             LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
+            //流水线中的下一个请求已经读入，不会再有读事件，直接放入请求队列；期限同样在入队前算好
+            time_t expire = users[sockfd].expire_at(time(NULL));
+            if (users[sockfd].pipelined() && !m_pool->append_p(users + sockfd))
+                users[sockfd].shed();
+
             if (timer)
             {
-                adjust_timer(timer);
+                adjust_timer(timer, expire);
             }
         }
         else
@@ -381,7 +777,9 @@ void WebServer::eventLoop()
 
     while (!stop_server)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        //还有没accept完的连接时不阻塞，处理完已就绪的事件就回来继续accept
+        //排空期间定期醒来检查期限
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, m_accept_pending ? 0 : (m_draining ? 100 : -1));
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
@@ -391,6 +789,7 @@ void WebServer::eventLoop()
         for (int i = 0; i < number; i++)
         {
             int sockfd = events[i].data.fd;
+            WS_PROBE2(dispatch, sockfd, events[i].events);
 
             //处理新到的客户连接
             if (sockfd == m_listenfd)
@@ -399,6 +798,20 @@ void WebServer::eventLoop()
                 if (false == flag)
                     continue;
             }
+            else if (sockfd == m_adminfd)
+            {
+                dealadminconn();
+            }
+            //存储后端(异步数据库连接)的读写事件
+            else if (m_store->owns(sockfd))
+            {
+                m_store->handle_event(sockfd, events[i].events);
+            }
+            //口令哈希计算完成
+            else if (m_kdf_pool && m_kdf_pool->owns(sockfd))
+            {
+                m_kdf_pool->handle_event(sockfd, events[i].events);
+            }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
                 //服务器端关闭连接，移除对应的定时器
@@ -422,13 +835,24 @@ void WebServer::eventLoop()
                 dealwithwrite(sockfd);
             }
         }
+        if (m_accept_pending)
+            dealclientdata();
         if (timeout)
         {
             utils.timer_handler();
+            log_admission();
 
             LOG_INFO("%s", "timer tick");
 
             timeout = false;
         }
+
+        //监听fd在本轮事件处理完后才关闭，否则同一轮里它的事件会被当作客户连接处理
+        if (m_draining && m_listenfd >= 0)
+            start_drain();
+        //连接全部关闭或到达期限后退出
+        if (m_draining && (0 == http_conn::m_user_count || trace::now_us() >= m_drain_deadline))
+            stop_server = true;
     }
+    stop();
 }
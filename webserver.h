@@ -14,6 +14,7 @@
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "config.h"
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
@@ -25,9 +26,7 @@ public:
     WebServer();
     ~WebServer();
 
-    void init(int port , string user, string passWord, string databaseName,
-              int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+    void init(const Config &config, string user, string passWord, string databaseName);
 
     void thread_pool();
     void sql_pool();
@@ -37,9 +36,17 @@ public:
     void eventLoop();
     void timer(int connfd, struct sockaddr_in client_address);
     void adjust_timer(util_timer *timer);
+    void adjust_timer(util_timer *timer, time_t expire);
     void deal_timer(util_timer *timer, int sockfd);
     bool dealclientdata();
+    void dealadminconn();
+    static void collect_metrics(void *arg, string &out);
+    int somaxconn();
+    void log_admission();
+    void rate_limit();
     bool dealwithsignal(bool& timeout, bool& stop_server);
+    void start_drain();
+    void stop();
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
 
@@ -50,21 +57,78 @@ public:
     int m_log_write;
     int m_close_log;
     int m_actormodel;
+    int m_access_sample;
+    int m_log_compress;
+    int m_log_max_files;
+    int m_log_max_size;
 
     int m_pipefd[2];
     int m_epollfd;
     http_conn *users;
 
     //数据库相关
-    connection_pool *m_connPool;
     string m_user;         //登陆数据库用户名
     string m_passWord;     //登陆数据库密码
     string m_databaseName; //使用数据库名
     int m_sql_num;
+    int m_sql_min;
+    int m_sql_idle;
+    int m_sql_timeout;
+    int m_async_sql_num;
+    int m_sql_batch;
+    int m_sql_batch_delay;
+
+    //用户存储相关
+    user_store *m_store;
+    string m_store_type;
+    string m_store_file;
+    int m_store_latency;
 
     //线程池相关
     threadpool<http_conn> *m_pool;
     int m_thread_num;
+    int m_queue_max;
+    int m_codel_target;
+    int m_codel_interval;
+    unsigned long long m_last_shed; //上次记录日志时的拒绝总数
+
+    //按IP限流，未开启时为NULL
+    rate_limiter *m_limiter;
+    rate_limit_conf m_limit_conf;
+    unsigned long long m_last_limited; //上次记录日志时的限流总数
+
+    //口令哈希计算线程池，明文存储时为NULL
+    compute_pool *m_kdf_pool;
+    int m_kdf_iter;
+    int m_kdf_threads;
+    int m_kdf_queue;
+
+    //请求消息体相关
+    int m_max_body;
+    string m_upload_dir;
+
+    //连接超时相关
+    int m_header_timeout;
+    int m_body_timeout;
+    int m_write_timeout;
+    int m_keepalive_timeout;
+    int m_max_requests;
+    int m_timeslot; //定时器检查间隔，不超过TIMESLOT和最短的超时
+
+    //accept相关
+    int m_backlog;
+    int m_accept_batch;
+    bool m_accept_pending; //ET监听模式下本轮accept达到上限，队列里可能还有连接
+
+    //管理端口，未开启时为-1
+    int m_admin_port;
+    int m_adminfd;
+
+    //优雅关闭：排空期间不再接受新连接，已有连接处理完当前请求后关闭
+    int m_drain_timeout;
+    int m_reuse_port;
+    bool m_draining;
+    long long m_drain_deadline; //单调时钟，微秒
 
     //epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];